@@ -15,6 +15,7 @@
 #define LLVM_TRANSFORMS_231DFA_H
 
 #include "llvm/InitializePasses.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
@@ -26,10 +27,31 @@
 #include <utility>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 
 namespace llvm {
 
 
+/*
+ * Whether an instruction defines a value that the analyses track:
+ * binary operators (including shifts and bitwise logic), alloca, load,
+ * getelementptr, icmp, fcmp, phi and select.
+ */
+inline bool definesValue(Instruction* I) {
+	switch (I->getOpcode()) {
+	case Instruction::Alloca:
+	case Instruction::Load:
+	case Instruction::GetElementPtr:
+	case Instruction::ICmp:
+	case Instruction::FCmp:
+	case Instruction::PHI:
+	case Instruction::Select:
+		return true;
+	default:
+		return I->isBinaryOp() || I->isShift() || I->isBitwiseLogicOp();
+	}
+}
+
 /*
  * This is the base class to represent information in a dataflow analysis.
  * For a specific analysis, you need to create a sublcass of it.
@@ -81,6 +103,125 @@ public:
 		result->getEdgeInfo() = std::move(temp);
 	}
 
+	/*
+	 * Hash a piece of information. Equal infos have equal hashes.
+	 */
+	static std::size_t hash(Info* info) {
+		std::size_t result = 0;
+		for (unsigned index : info->getEdgeInfo()) {
+			result += hash_value(index);
+		}
+		return result;
+	}
+
+};
+
+/*
+ * The table of interned infos.
+ * Equal infos are stored once, so two interned infos are equal iff their pointers are.
+ * An interned info must not be modified. It is reference counted and freed when
+ * the last reference is released.
+ */
+template <class Info>
+class InfoTable {
+public:
+	InfoTable() = default;
+	InfoTable(const InfoTable&) = delete;
+	InfoTable& operator=(const InfoTable&) = delete;
+
+	~InfoTable() {
+		clearJoinCache();
+		for (auto const& it : Entries)
+			delete it.first;
+	}
+
+	/*
+	 * Intern a newly allocated info and take ownership of it.
+	 * Returns the canonical info with one reference for the caller.
+	 */
+	Info* intern(Info* info) {
+		std::size_t hash = Info::hash(info);
+		auto range = Table.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (Info::equals(it->second, info)) {
+				delete info;
+				retain(it->second);
+				return it->second;
+			}
+		}
+		Table.emplace(hash, info);
+		Entries[info] = std::make_pair(1u, hash);
+		return info;
+	}
+
+	void retain(Info* info) {
+		++Entries[info].first;
+	}
+
+	void release(Info* info) {
+		auto entry = Entries.find(info);
+		assert(entry != Entries.end() && "Releasing an info that is not interned.");
+		if (--entry->second.first != 0)
+			return;
+
+		auto range = Table.equal_range(entry->second.second);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second == info) {
+				Table.erase(it);
+				break;
+			}
+		}
+		Entries.erase(entry);
+		delete info;
+	}
+
+	/*
+	 * Join two interned infos (nullptr stands for bottom).
+	 * The results are memoized on the pair of infos. The result is owned by
+	 * the memo, so copy it before the next call if you need to keep it.
+	 */
+	Info* join(Info* info1, Info* info2) {
+		if (!info1 || info1 == info2)
+			return info2;
+		if (!info2)
+			return info1;
+
+		auto key = std::make_pair(info1, info2);
+		auto it = JoinCache.find(key);
+		if (it != JoinCache.end())
+			return it->second;
+
+		Info* result = new Info;
+		Info::join(info1, info2, result);
+		result = intern(result);
+		retain(info1);
+		retain(info2);
+		// Clear only now that the new entry holds its references: info2 is
+		// often an earlier result that nothing but the memo keeps alive
+		if (JoinCache.size() >= MaxJoinCacheSize)
+			clearJoinCache();
+		JoinCache[key] = result;
+		return result;
+	}
+
+private:
+	static const std::size_t MaxJoinCacheSize = 1 << 16;
+
+	void clearJoinCache() {
+		for (auto const& it : JoinCache) {
+			release(it.first.first);
+			release(it.first.second);
+			release(it.second);
+		}
+		JoinCache.clear();
+	}
+
+	// Hash to interned infos
+	std::unordered_multimap<std::size_t, Info*> Table;
+	// Interned info to its reference count and hash
+	std::unordered_map<Info*, std::pair<unsigned, std::size_t>> Entries;
+	// Memoized joins
+	std::map<std::pair<Info*, Info*>, Info*> JoinCache;
 };
 
 /*
@@ -104,6 +245,8 @@ protected:
 	Info InitialState;
 	// EntryInstr points to the first instruction to be processed in the analysis
 	Instruction* EntryInstr;
+	// Every info stored in EdgeToInfo is interned here
+	InfoTable<Info> InternedInfos;
 
 
 	/*
@@ -180,6 +323,33 @@ protected:
 		return;
 	}
 
+	/*
+	 * Utility function:
+	 *   Replace &Bottom and &InitialState in EdgeToInfo with interned copies.
+	 */
+	void internInitialInfos() {
+		Info* bottom = InternedInfos.intern(new Info(Bottom));
+		Info* initialState = InternedInfos.intern(new Info(InitialState));
+		for (auto& it : EdgeToInfo) {
+			it.second = it.second == &InitialState ? initialState : bottom;
+			InternedInfos.retain(it.second);
+		}
+		InternedInfos.release(bottom);
+		InternedInfos.release(initialState);
+	}
+
+	/*
+	 * Utility function:
+	 *   Join the infos on the incoming edges of the node identified by index.
+	 *   The result is interned and must not be modified; copy it to build the outgoing info.
+	 */
+	Info* joinIncomingInfos(unsigned index, std::vector<unsigned> & IncomingEdges) {
+		Info* result = nullptr;
+		for (unsigned preIndex : IncomingEdges)
+			result = InternedInfos.join(EdgeToInfo[std::make_pair(preIndex, index)], result);
+		return result ? result : &Bottom;
+	}
+
 	/*
 	 * Initialize EdgeToInfo and EntryInstr for a forward analysis.
 	 */
@@ -304,7 +474,12 @@ public:
 	DataFlowAnalysis(Info& bottom, Info& initialState) :
 		Bottom(bottom), InitialState(initialState), EntryInstr(nullptr) {}
 
-	virtual ~DataFlowAnalysis() = default;
+	virtual ~DataFlowAnalysis() {
+		for (auto const& it : EdgeToInfo) {
+			if (it.second != &Bottom && it.second != &InitialState)
+				InternedInfos.release(it.second);
+		}
+	}
 
 	/*
 	 * Print out the analysis results.
@@ -341,6 +516,8 @@ public:
 
 		assert(EntryInstr != nullptr && "Entry instruction is null.");
 
+		internInitialInfos();
+
 		// (2) Initialize the work list
 		std::unordered_set<unsigned> inList;
 
@@ -375,14 +552,19 @@ public:
 				unsigned nexNode = outgoingEdges[i];
 				Edge outEdge = std::make_pair(curNode, nexNode);
 				Info* oldOutInfo = EdgeToInfo[outEdge];
-				Info* newOutInfo = newOutInfos[i];
-				if (!Info::equals(oldOutInfo, newOutInfo)) {
+				Info* newOutInfo = InternedInfos.intern(newOutInfos[i]);
+				// Interned infos are equal iff they are the same
+				if (oldOutInfo != newOutInfo) {
+					InternedInfos.release(oldOutInfo);
 					EdgeToInfo[outEdge] = newOutInfo;
 					if (!inList.count(nexNode)) {
 						worklist.push_back(nexNode);
 						inList.insert(nexNode);
 					}
 				}
+				else {
+					InternedInfos.release(newOutInfo);
+				}
 			}
 		}
 		print();
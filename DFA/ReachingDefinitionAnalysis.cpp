@@ -55,8 +55,6 @@ public:
 	virtual ~ReachingDefinitionAnalysis() override = default;
 
 private:
-	static const std::unordered_set<unsigned> opCodes;
-
 	/*
 	* The flow function.
 	*   Instruction I: the IR instruction to be processed.
@@ -71,15 +69,8 @@ private:
 							  std::vector<ReachingInfo*>& Infos) override
 	{
 		unsigned curIndex = InstrToIndex[I];
-		ReachingInfo outInfo;
-		for (unsigned preIndex : IncomingEdges) {
-			Edge incomingEdge = std::make_pair(preIndex, curIndex);
-			ReachingInfo::join(EdgeToInfo[incomingEdge], &outInfo, &outInfo);
-		}
-		if (I && (I->isBinaryOp() ||
-				  I->isShift() ||
-				  I->isBitwiseLogicOp() ||
-				  opCodes.count(I->getOpcode()))) {
+		ReachingInfo outInfo(*joinIncomingInfos(curIndex, IncomingEdges));
+		if (I && definesValue(I)) {
 			outInfo.getEdgeInfo().insert(curIndex);
 		}
 
@@ -92,16 +83,6 @@ private:
 	}
 };
 
-const std::unordered_set<unsigned> ReachingDefinitionAnalysis::opCodes{
-	Instruction::Alloca,
-	Instruction::Load,
-	Instruction::GetElementPtr,
-	Instruction::ICmp,
-	Instruction::FCmp,
-	Instruction::PHI,
-	Instruction::Select
-};
-
 namespace {
 
 struct ReachingDefinitionAnalysisPass : public FunctionPass {
@@ -0,0 +1,15 @@
+#include "231DFA.h"
+
+namespace llvm {
+
+cl::opt<unsigned> DFACheckpointInterval(
+	"dfa-checkpoint-interval",
+	cl::desc("Keep the info of every N-th edge inside a basic block (0: only edges between blocks)"),
+	cl::init(1));
+
+cl::opt<unsigned> DFAMemoryBudget(
+	"dfa-memory-budget",
+	cl::desc("Memory budget in MB for the edge infos of one function; picks the checkpoint interval (0: unlimited)"),
+	cl::init(0));
+
+}
@@ -15,14 +15,19 @@
 #define LLVM_TRANSFORMS_231DFA_H
 
 #include "llvm/InitializePasses.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <deque>
 #include <map>
+#include <set>
 #include <utility>
 #include <vector>
 #include <unordered_set>
@@ -30,6 +35,29 @@
 
 namespace llvm {
 
+// Defined in 231DFA.cpp. The passes hand them to setCheckpointInterval() and setMemoryBudget().
+extern cl::opt<unsigned> DFACheckpointInterval;
+extern cl::opt<unsigned> DFAMemoryBudget;
+
+/*
+ * Whether an instruction defines a value that the analyses track:
+ * binary operators (including shifts and bitwise logic), alloca, load,
+ * getelementptr, icmp, fcmp, phi and select.
+ */
+inline bool definesValue(Instruction* I) {
+	switch (I->getOpcode()) {
+	case Instruction::Alloca:
+	case Instruction::Load:
+	case Instruction::GetElementPtr:
+	case Instruction::ICmp:
+	case Instruction::FCmp:
+	case Instruction::PHI:
+	case Instruction::Select:
+		return true;
+	default:
+		return I->isBinaryOp() || I->isShift() || I->isBitwiseLogicOp();
+	}
+}
 
 /*
  * This is the base class to represent information in a dataflow analysis.
@@ -66,6 +94,132 @@ public:
 	 */
 	static void join(Info* info1, Info* info2, Info* result);
 
+	/*
+	 * Hash a piece of information. Equal infos must have equal hashes.
+	 *
+	 * Direction:
+	 *   In your subclass you need to implement this function.
+	 */
+	static std::size_t hash(Info* info);
+
+};
+
+/*
+ * Order independent hash of a set of indices, for the hash() of the infos.
+ */
+inline std::size_t hashIndexSet(const std::unordered_set<unsigned>& indices) {
+	std::size_t result = 0;
+	for (unsigned index : indices)
+		result += hash_value(index);
+	return result;
+}
+
+/*
+ * The table of interned infos.
+ * Equal infos are stored once, so two interned infos are equal iff their pointers are.
+ * An interned info must not be modified. It is reference counted and freed when
+ * the last reference is released.
+ */
+template <class Info>
+class InfoTable {
+public:
+	InfoTable() = default;
+	InfoTable(const InfoTable&) = delete;
+	InfoTable& operator=(const InfoTable&) = delete;
+
+	~InfoTable() {
+		clearJoinCache();
+		for (auto const& it : Entries)
+			delete it.first;
+	}
+
+	/*
+	 * Intern a newly allocated info and take ownership of it.
+	 * Returns the canonical info with one reference for the caller.
+	 */
+	Info* intern(Info* info) {
+		std::size_t hash = Info::hash(info);
+		auto range = Table.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (Info::equals(it->second, info)) {
+				delete info;
+				retain(it->second);
+				return it->second;
+			}
+		}
+		Table.emplace(hash, info);
+		Entries[info] = std::make_pair(1u, hash);
+		return info;
+	}
+
+	void retain(Info* info) {
+		++Entries[info].first;
+	}
+
+	void release(Info* info) {
+		auto entry = Entries.find(info);
+		assert(entry != Entries.end() && "Releasing an info that is not interned.");
+		if (--entry->second.first != 0)
+			return;
+
+		auto range = Table.equal_range(entry->second.second);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second == info) {
+				Table.erase(it);
+				break;
+			}
+		}
+		Entries.erase(entry);
+		delete info;
+	}
+
+	/*
+	 * Join two interned infos (nullptr stands for bottom).
+	 * The results are memoized on the pair of infos. The result is owned by
+	 * the memo, so copy it before the next call if you need to keep it.
+	 */
+	Info* join(Info* info1, Info* info2) {
+		if (!info1 || info1 == info2)
+			return info2;
+		if (!info2)
+			return info1;
+
+		auto key = std::make_pair(info1, info2);
+		auto it = JoinCache.find(key);
+		if (it != JoinCache.end())
+			return it->second;
+
+		Info* result = new Info;
+		Info::join(info1, info2, result);
+		result = intern(result);
+		retain(info1);
+		retain(info2);
+		// Clear only now that the new entry holds its references: info2 is
+		// often an earlier result that nothing but the memo keeps alive
+		if (JoinCache.size() >= MaxJoinCacheSize)
+			clearJoinCache();
+		JoinCache[key] = result;
+		return result;
+	}
+
+private:
+	static const std::size_t MaxJoinCacheSize = 1 << 16;
+
+	void clearJoinCache() {
+		for (auto const& it : JoinCache) {
+			release(it.first.first);
+			release(it.first.second);
+			release(it.second);
+		}
+		JoinCache.clear();
+	}
+
+	// Hash to interned infos
+	std::unordered_multimap<std::size_t, Info*> Table;
+	// Interned info to its reference count and hash
+	std::unordered_map<Info*, std::pair<unsigned, std::size_t>> Entries;
+	// Memoized joins
+	std::map<std::pair<Info*, Info*>, Info*> JoinCache;
 };
 
 /*
@@ -82,13 +236,26 @@ protected:
 	// Instruction to index map
 	std::map<Instruction*, unsigned> InstrToIndex;
 	// Edge to information map
+	// With checkpointing enabled, dropped intra-block edges map to nullptr.
 	std::map<Edge, Info*> EdgeToInfo;
+	// Sorted sources of the incoming edges and destinations of the outgoing edges of each node
+	std::map<unsigned, std::set<unsigned>> IncomingNodes;
+	std::map<unsigned, std::set<unsigned>> OutgoingNodes;
 	// The bottom of the lattice
 	Info Bottom;
 	// The initial state of the analysis
 	Info InitialState;
 	// EntryInstr points to the first instruction to be processed in the analysis
 	Instruction* EntryInstr;
+	// Keep the info of every CheckpointInterval-th edge inside a basic block.
+	// 1 keeps all edges, 0 keeps only the edges between basic blocks.
+	unsigned CheckpointInterval;
+	// Upper bound in bytes for the stored infos. 0 means unlimited.
+	std::size_t MemoryBudget;
+	// Infos of dropped edges recomputed for the last query
+	std::map<Edge, Info*> RecomputedInfos;
+	// Every info stored in EdgeToInfo and RecomputedInfos is interned here
+	InfoTable<Info> InternedInfos;
 
 
 	/*
@@ -129,10 +296,9 @@ protected:
 	void getIncomingEdges(unsigned index, std::vector<unsigned>* IncomingEdges) {
 		assert(IncomingEdges->size() == 0 && "IncomingEdges should be empty.");
 
-		for (auto const& it : EdgeToInfo) {
-			if (it.first.second == index)
-				IncomingEdges->push_back(it.first.first);
-		}
+		auto it = IncomingNodes.find(index);
+		if (it != IncomingNodes.end())
+			IncomingEdges->assign(it->second.begin(), it->second.end());
 
 		return;
 	}
@@ -145,10 +311,9 @@ protected:
 	void getOutgoingEdges(unsigned index, std::vector<unsigned> * OutgoingEdges) {
 		assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
 
-		for (auto const& it : EdgeToInfo) {
-			if (it.first.first == index)
-				OutgoingEdges->push_back(it.first.second);
-		}
+		auto it = OutgoingNodes.find(index);
+		if (it != OutgoingNodes.end())
+			OutgoingEdges->assign(it->second.begin(), it->second.end());
 
 		return;
 	}
@@ -160,11 +325,50 @@ protected:
 	 */
 	void addEdge(Instruction * src, Instruction * dst, Info * content) {
 		Edge edge = std::make_pair(InstrToIndex[src], InstrToIndex[dst]);
-		if (EdgeToInfo.count(edge) == 0)
+		if (EdgeToInfo.count(edge) == 0) {
 			EdgeToInfo[edge] = content;
+			OutgoingNodes[edge.first].insert(edge.second);
+			IncomingNodes[edge.second].insert(edge.first);
+		}
 		return;
 	}
 
+	/*
+	 * Utility function:
+	 *   Drop the reference of an edge to its interned info.
+	 */
+	void releaseInfo(Info * info) {
+		if (info)
+			InternedInfos.release(info);
+	}
+
+	/*
+	 * Utility function:
+	 *   Replace &Bottom and &InitialState in EdgeToInfo with interned copies.
+	 */
+	void internInitialInfos() {
+		Info* bottom = InternedInfos.intern(new Info(Bottom));
+		Info* initialState = InternedInfos.intern(new Info(InitialState));
+		for (auto& it : EdgeToInfo) {
+			it.second = it.second == &InitialState ? initialState : bottom;
+			InternedInfos.retain(it.second);
+		}
+		InternedInfos.release(bottom);
+		InternedInfos.release(initialState);
+	}
+
+	/*
+	 * Utility function:
+	 *   Join the infos on the incoming edges of the node identified by index.
+	 *   The result is interned and must not be modified; copy it to build the outgoing info.
+	 */
+	Info* joinIncomingInfos(unsigned index, std::vector<unsigned> & IncomingEdges) {
+		Info* result = nullptr;
+		for (unsigned preIndex : IncomingEdges)
+			result = InternedInfos.join(EdgeToInfo[std::make_pair(preIndex, index)], result);
+		return result ? result : &Bottom;
+	}
+
 	/*
 	 * Initialize EdgeToInfo and EntryInstr for a forward analysis.
 	 */
@@ -285,11 +489,228 @@ protected:
 							  std::vector<unsigned> & OutgoingEdges,
 							  std::vector<Info*> & Infos) = 0;
 
+	/*
+	 * Utility function:
+	 *   Get the nodes of a basic block in the order the analysis visits them.
+	 *   A block with phi nodes is represented by its first phi node.
+	 */
+	void getBlockNodes(BasicBlock * block, std::vector<unsigned> & Nodes) {
+		Instruction* firstInstr = &(block->front());
+		if (isa<PHINode>(firstInstr))
+			Nodes.push_back(InstrToIndex[firstInstr]);
+		for (Instruction& instr : *block) {
+			if (!isa<PHINode>(&instr))
+				Nodes.push_back(InstrToIndex[&instr]);
+		}
+		if (!Direction)
+			std::reverse(Nodes.begin(), Nodes.end());
+	}
+
+	/*
+	 * Utility function:
+	 *   Whether the edge between Nodes[pos - 1] and Nodes[pos] of a block is kept.
+	 */
+	bool isCheckpoint(unsigned pos) const {
+		return CheckpointInterval != 0 && pos % CheckpointInterval == 0;
+	}
+
+	/*
+	 * Pick CheckpointInterval so that the stored infos fit into MemoryBudget.
+	 * Every info is assumed to hold a quarter of the instructions of the function.
+	 */
+	void chooseCheckpointInterval() {
+		if (MemoryBudget == 0)
+			return;
+
+		std::size_t interEdges = 0, intraEdges = 0;
+		for (auto const& it : EdgeToInfo) {
+			Instruction* src = IndexToInstr[it.first.first];
+			Instruction* dst = IndexToInstr[it.first.second];
+			if (src && src->getParent() == dst->getParent())
+				++intraEdges;
+			else
+				++interEdges;
+		}
+
+		std::size_t bytesPerInfo = sizeof(Info) + IndexToInstr.size() / 4 * 2 * sizeof(void*);
+		if ((interEdges + intraEdges) * bytesPerInfo <= MemoryBudget)
+			CheckpointInterval = 1;
+		else if (interEdges * bytesPerInfo >= MemoryBudget)
+			CheckpointInterval = 0;
+		else
+			CheckpointInterval = intraEdges * bytesPerInfo / (MemoryBudget - interEdges * bytesPerInfo) + 1;
+	}
+
+	/*
+	 * Worklist algorithm over basic blocks for CheckpointInterval != 1.
+	 * The facts inside a block only live while the block is processed,
+	 * except for the checkpoints. Only changes on the edges between blocks
+	 * put blocks back on the worklist.
+	 */
+	void runCheckpointedWorklistAlgorithm(Function * func) {
+		std::deque<BasicBlock*> worklist;
+		std::set<BasicBlock*> inList;
+
+		for (BasicBlock& block : *func) {
+			if (Direction)
+				worklist.push_back(&block);
+			else
+				worklist.push_front(&block);
+			inList.insert(&block);
+		}
+
+		while (!worklist.empty()) {
+			BasicBlock* curBlock = worklist.front();
+			worklist.pop_front();
+			inList.erase(curBlock);
+
+			std::vector<unsigned> nodes;
+			getBlockNodes(curBlock, nodes);
+
+			for (unsigned pos = 0; pos < nodes.size(); ++pos) {
+				unsigned curNode = nodes[pos];
+
+				std::vector<unsigned> incomingEdges, outgoingEdges;
+				getIncomingEdges(curNode, &incomingEdges);
+				getOutgoingEdges(curNode, &outgoingEdges);
+
+				std::vector<Info*> newOutInfos;
+				flowfunction(IndexToInstr[curNode], incomingEdges, outgoingEdges, newOutInfos);
+
+				for (std::size_t i = 0; i < newOutInfos.size(); ++i) {
+					unsigned nexNode = outgoingEdges[i];
+					Info*& outInfo = EdgeToInfo[std::make_pair(curNode, nexNode)];
+					Info* newOutInfo = InternedInfos.intern(newOutInfos[i]);
+
+					// The next node of the block consumes it right away
+					if (pos + 1 < nodes.size() && nexNode == nodes[pos + 1]) {
+						releaseInfo(outInfo);
+						outInfo = newOutInfo;
+					}
+					else if (outInfo != newOutInfo) {
+						releaseInfo(outInfo);
+						outInfo = newOutInfo;
+						BasicBlock* nexBlock = IndexToInstr[nexNode]->getParent();
+						if (!inList.count(nexBlock)) {
+							worklist.push_back(nexBlock);
+							inList.insert(nexBlock);
+						}
+					}
+					else {
+						releaseInfo(newOutInfo);
+					}
+				}
+
+				// The edge into curNode is no longer needed unless it is a checkpoint
+				if (pos > 0 && !isCheckpoint(pos)) {
+					Info*& inInfo = EdgeToInfo[std::make_pair(nodes[pos - 1], curNode)];
+					releaseInfo(inInfo);
+					inInfo = nullptr;
+				}
+			}
+		}
+	}
+
+	/*
+	 * Recompute the dropped edges between the checkpoints around the intra-block edge (src, dst).
+	 * The results are kept in RecomputedInfos until the next call.
+	 */
+	void recomputeEdges(unsigned src, unsigned dst) {
+		for (auto const& it : RecomputedInfos)
+			releaseInfo(it.second);
+		RecomputedInfos.clear();
+
+		std::vector<unsigned> nodes;
+		getBlockNodes(IndexToInstr[dst]->getParent(), nodes);
+		unsigned dstPos = std::find(nodes.begin(), nodes.end(), dst) - nodes.begin();
+		assert(dstPos > 0 && dstPos < nodes.size() && nodes[dstPos - 1] == src && "Not an intra-block edge.");
+
+		// Replay from the last stored edge before (src, dst) up to the next stored one
+		unsigned begin = dstPos - 1;
+		while (begin > 0 && !EdgeToInfo[std::make_pair(nodes[begin - 1], nodes[begin])])
+			--begin;
+		unsigned end = dstPos;
+		while (end + 1 < nodes.size() && !EdgeToInfo[std::make_pair(nodes[end], nodes[end + 1])])
+			++end;
+
+		for (unsigned pos = begin; pos < end; ++pos) {
+			unsigned curNode = nodes[pos];
+
+			std::vector<unsigned> incomingEdges, outgoingEdges;
+			getIncomingEdges(curNode, &incomingEdges);
+			getOutgoingEdges(curNode, &outgoingEdges);
+
+			std::vector<Info*> newOutInfos;
+			flowfunction(IndexToInstr[curNode], incomingEdges, outgoingEdges, newOutInfos);
+
+			for (std::size_t i = 0; i < newOutInfos.size(); ++i) {
+				Edge outEdge = std::make_pair(curNode, outgoingEdges[i]);
+				if (outgoingEdges[i] == nodes[pos + 1] && !EdgeToInfo[outEdge]) {
+					EdgeToInfo[outEdge] = InternedInfos.intern(newOutInfos[i]);
+					RecomputedInfos[outEdge] = EdgeToInfo[outEdge];
+				}
+				else {
+					delete newOutInfos[i];
+				}
+			}
+		}
+
+		// Drop them from EdgeToInfo again
+		for (auto const& it : RecomputedInfos)
+			EdgeToInfo[it.first] = nullptr;
+	}
+
 public:
 	DataFlowAnalysis(Info& bottom, Info& initialState) :
-		Bottom(bottom), InitialState(initialState), EntryInstr(nullptr) {}
+		Bottom(bottom), InitialState(initialState), EntryInstr(nullptr),
+		CheckpointInterval(1), MemoryBudget(0) {}
+
+	virtual ~DataFlowAnalysis() {
+		for (auto const& it : EdgeToInfo)
+			releaseInfo(it.second);
+		for (auto const& it : RecomputedInfos)
+			releaseInfo(it.second);
+	}
+
+	/*
+	 * Keep only every interval-th edge inside a basic block (0: only the edges between blocks).
+	 * The dropped edges are recomputed when they are printed or queried.
+	 */
+	void setCheckpointInterval(unsigned interval) {
+		CheckpointInterval = interval;
+	}
+
+	/*
+	 * Choose the checkpoint interval automatically so that the infos fit into bytes.
+	 * Overrides setCheckpointInterval(). 0 means unlimited.
+	 */
+	void setMemoryBudget(std::size_t bytes) {
+		MemoryBudget = bytes;
+	}
 
-	virtual ~DataFlowAnalysis() = default;
+	/*
+	 * Get the index of an instruction, 0 if it is not part of the analyzed function.
+	 */
+	unsigned getIndex(Instruction * I) const {
+		auto it = InstrToIndex.find(I);
+		return it == InstrToIndex.end() ? 0 : it->second;
+	}
+
+	/*
+	 * Get the information on the edge src->dst, recomputing it if it was dropped.
+	 * The result is owned by the analysis and stays valid until the next query.
+	 */
+	Info* getEdgeInfo(unsigned src, unsigned dst) {
+		Edge edge = std::make_pair(src, dst);
+		auto it = EdgeToInfo.find(edge);
+		if (it == EdgeToInfo.end())
+			return nullptr;
+		if (it->second)
+			return it->second;
+		if (!RecomputedInfos.count(edge))
+			recomputeEdges(src, dst);
+		return RecomputedInfos[edge];
+	}
 
 	/*
 	 * Print out the analysis results.
@@ -301,7 +722,7 @@ public:
 	void print() {
 		for (auto const& it : EdgeToInfo) {
 			errs() << "Edge " << it.first.first << "->" "Edge " << it.first.second << ":";
-			(it.second)->print();
+			getEdgeInfo(it.first.first, it.first.second)->print();
 		}
 	}
 
@@ -310,12 +731,13 @@ public:
 	 * (1) Initialize info of each edge to bottom
 	 * (2) Initialize the worklist
 	 * (3) Compute until the worklist is empty
+	 * The results are printed unless printResult is false.
 	 *
 	 * Direction:
 	 *   Implement the rest of the function.
 	 *   You may not change anything before "// (2) Initialize the worklist".
 	 */
-	void runWorklistAlgorithm(Function * func) {
+	void runWorklistAlgorithm(Function * func, bool printResult = true) {
 		std::deque<unsigned> worklist;
 
 		// (1) Initialize info of each edge to bottom
@@ -326,6 +748,15 @@ public:
 
 		assert(EntryInstr != nullptr && "Entry instruction is null.");
 
+		internInitialInfos();
+		chooseCheckpointInterval();
+		if (CheckpointInterval != 1) {
+			runCheckpointedWorklistAlgorithm(func);
+			if (printResult)
+				print();
+			return;
+		}
+
 		// (2) Initialize the work list
 		std::unordered_set<unsigned> inList;
 
@@ -360,21 +791,235 @@ public:
 				unsigned nexNode = outgoingEdges[i];
 				Edge outEdge = std::make_pair(curNode, nexNode);
 				Info* oldOutInfo = EdgeToInfo[outEdge];
-				Info* newOutInfo = newOutInfos[i];
-				if (!Info::equals(oldOutInfo, newOutInfo)) {
+				Info* newOutInfo = InternedInfos.intern(newOutInfos[i]);
+				// Interned infos are equal iff they are the same
+				if (oldOutInfo != newOutInfo) {
+					releaseInfo(oldOutInfo);
 					EdgeToInfo[outEdge] = newOutInfo;
 					if (!inList.count(nexNode)) {
 						worklist.push_back(nexNode);
 						inList.insert(nexNode);
 					}
 				}
+				else {
+					releaseInfo(newOutInfo);
+				}
 			}
 		}
-		print();
+		if (printResult)
+			print();
 	}
 };
 
 
+/*
+ * The information of a gen/kill analysis: one bit per element of the analysis domain.
+ * The meet is a union if MeetIsUnion and an intersection otherwise.
+ * Labels maps the bits to the indices that print() shows.
+ */
+template <bool MeetIsUnion>
+class BitVectorInfo : public Info {
+public:
+	BitVectorInfo() : Labels(nullptr) {}
+	BitVectorInfo(const std::vector<unsigned>* labels, bool value) :
+		Bits(labels->size(), value),
+		Labels(labels)
+	{
+	}
+	BitVectorInfo(const BitVectorInfo& other) :
+		Info(other),
+		Bits(other.Bits),
+		Labels(other.Labels)
+	{
+	}
+	BitVectorInfo& operator=(const BitVectorInfo& other) {
+		Bits = other.Bits;
+		Labels = other.Labels;
+		return *this;
+	}
+	virtual ~BitVectorInfo() override = default;
+
+	virtual void print() override {
+		for (int bit = Bits.find_first(); bit != -1; bit = Bits.find_next(bit)) {
+			errs() << (*Labels)[bit] << '|';
+		}
+		errs() << '\n';
+	}
+
+	static bool equals(BitVectorInfo* info1, BitVectorInfo* info2) {
+		return info1->Bits == info2->Bits;
+	}
+
+	static void join(BitVectorInfo* info1, BitVectorInfo* info2, BitVectorInfo* result) {
+		if (!result) {
+			return;
+		}
+		if (!info1 || !info2) {
+			*result = info1 ? *info1 : *info2;
+			return;
+		}
+		BitVectorInfo temp(*info1);
+		if (MeetIsUnion)
+			temp.Bits |= info2->Bits;
+		else
+			temp.Bits &= info2->Bits;
+		*result = temp;
+	}
+
+	static std::size_t hash(BitVectorInfo* info) {
+		hash_code result = hash_value(info->Bits.size());
+		for (int bit = info->Bits.find_first(); bit != -1; bit = info->Bits.find_next(bit))
+			result = hash_combine(result, bit);
+		return result;
+	}
+
+	BitVector Bits;
+	const std::vector<unsigned>* Labels;
+};
+
+/*
+ * The generic engine for gen/kill analyses on bit vectors.
+ *   Direction: true for forward, false for backward analyses.
+ *   MeetIsUnion: true for may analyses (union), false for must analyses (intersection).
+ *
+ * A subclass numbers the elements of its domain in initializeDomain() and
+ * describes each instruction in getGenKill(). The flow function computes
+ *   out = gen | (in & ~kill)
+ * word by word. Bottom is the empty set for a union meet and the full set
+ * for an intersection. The boundary (entry or exits) is the empty set.
+ */
+template <bool Direction, bool MeetIsUnion>
+class GenKillAnalysis : public DataFlowAnalysis<BitVectorInfo<MeetIsUnion>, Direction> {
+public:
+	typedef BitVectorInfo<MeetIsUnion> GenKillInfo;
+
+	GenKillAnalysis() :
+		DataFlowAnalysis<GenKillInfo, Direction>(EmptyInfo, EmptyInfo)
+	{
+	}
+
+	virtual ~GenKillAnalysis() override = default;
+
+	/*
+	 * Number the domain of func, then run the worklist algorithm on it.
+	 * The results are printed unless printResult is false.
+	 */
+	void analyze(Function * func, bool printResult = true) {
+		Labels.clear();
+		this->assignIndiceToInstrs(func);
+		initializeDomain(func, Labels);
+
+		this->Bottom = GenKillInfo(&Labels, !MeetIsUnion);
+		this->InitialState = GenKillInfo(&Labels, false);
+		Gen.resize(Labels.size());
+		Kill.resize(Labels.size());
+
+		this->runWorklistAlgorithm(func, printResult);
+	}
+
+	/*
+	 * The bits right before I in program order, before all the phi nodes of
+	 * its block if I is one. Call it after analyze().
+	 */
+	BitVector getBitsBefore(Instruction * I) {
+		Instruction* node = isa<PHINode>(I) ? &I->getParent()->front() : I;
+		unsigned index = this->InstrToIndex[node];
+		std::vector<unsigned> edges;
+		if (Direction)
+			this->getIncomingEdges(index, &edges);
+		else
+			this->getOutgoingEdges(index, &edges);
+		return meetEdges(index, edges, Direction);
+	}
+
+	/*
+	 * The bits right after I in program order, after all the phi nodes of
+	 * its block if I is one. Call it after analyze().
+	 */
+	BitVector getBitsAfter(Instruction * I) {
+		Instruction* node = isa<PHINode>(I) ? &I->getParent()->front() : I;
+		unsigned index = this->InstrToIndex[node];
+		std::vector<unsigned> edges;
+		if (Direction)
+			this->getOutgoingEdges(index, &edges);
+		else
+			this->getIncomingEdges(index, &edges);
+		return meetEdges(index, edges, !Direction);
+	}
+
+protected:
+	/*
+	 * Number the elements of the domain of func.
+	 * Labels[i] is what print() shows for the i-th element, usually an instruction index.
+	 * InstrToIndex is already filled in when this is called.
+	 */
+	virtual void initializeDomain(Function * func, std::vector<unsigned> & Labels) = 0;
+
+	/*
+	 * Set the elements generated and killed by I. Gen and Kill come in cleared.
+	 */
+	virtual void getGenKill(Instruction * I, BitVector & Gen, BitVector & Kill) = 0;
+
+private:
+	static GenKillInfo EmptyInfo;
+
+	/*
+	 * The meet of the edges between index and each of edges, which lead into
+	 * index if incoming. Without edges it is the empty set, as at the boundary.
+	 */
+	BitVector meetEdges(unsigned index, const std::vector<unsigned>& edges, bool incoming) {
+		BitVector bits(Gen.size());
+		for (unsigned i = 0; i < edges.size(); ++i) {
+			const BitVector& edgeBits = (incoming ? this->getEdgeInfo(edges[i], index) : this->getEdgeInfo(index, edges[i]))->Bits;
+			if (i == 0)
+				bits = edgeBits;
+			else if (MeetIsUnion)
+				bits |= edgeBits;
+			else
+				bits &= edgeBits;
+		}
+		return bits;
+	}
+
+	virtual void flowfunction(Instruction * I,
+							  std::vector<unsigned> & IncomingEdges,
+							  std::vector<unsigned> & OutgoingEdges,
+							  std::vector<GenKillInfo*> & Infos) override
+	{
+		if (!I) {
+			return;
+		}
+
+		unsigned curIndex = this->InstrToIndex[I];
+		// Exits other than the one with InitialState have no incoming edges in a backward analysis
+		GenKillInfo outInfo(!Direction && IncomingEdges.empty() ?
+			this->InitialState :
+			*this->joinIncomingInfos(curIndex, IncomingEdges));
+
+		// The first phi node stands for all phi nodes of its block
+		for (Instruction* instr = I; instr; instr = instr->getNextNode()) {
+			Gen.reset();
+			Kill.reset();
+			getGenKill(instr, Gen, Kill);
+			outInfo.Bits.reset(Kill);
+			outInfo.Bits |= Gen;
+			if (!isa<PHINode>(instr) || !isa<PHINode>(instr->getNextNode()))
+				break;
+		}
+
+		for (unsigned nexIndex : OutgoingEdges) {
+			Infos.push_back(new GenKillInfo);
+			GenKillInfo::join(&outInfo, this->EdgeToInfo[std::make_pair(curIndex, nexIndex)], Infos.back());
+		}
+	}
+
+	std::vector<unsigned> Labels;
+	BitVector Gen;
+	BitVector Kill;
+};
+
+template <bool Direction, bool MeetIsUnion>
+BitVectorInfo<MeetIsUnion> GenKillAnalysis<Direction, MeetIsUnion>::EmptyInfo;
 
 }
 #endif // End LLVM_231DFA_H
@@ -0,0 +1,29 @@
+#include "ExpressionAnalysis.h"
+
+namespace llvm {
+
+namespace {
+
+struct AvailableExpressionsPass : public FunctionPass {
+	static char ID;
+	AvailableExpressionsPass() : FunctionPass(ID) {}
+
+	virtual bool runOnFunction(Function& func) override {
+		AvailableExpressionsAnalysis analysis;
+		analysis.setCheckpointInterval(DFACheckpointInterval);
+		analysis.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		analysis.analyze(&func);
+
+		return false;
+	}
+};
+}
+
+char AvailableExpressionsPass::ID = 0;
+static RegisterPass<AvailableExpressionsPass> cse231_available(
+	"cse231-available",
+	"cse231-available",
+	false,
+	false);
+
+}
@@ -0,0 +1,207 @@
+#include "231DFA.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+namespace llvm {
+
+namespace {
+
+/*
+ * The definitions of the scalar allocas that reach each point: a forward
+ * gen/kill analysis whose domain is the stores into those allocas, and the
+ * allocas themselves standing for their undefined initial value. Every
+ * definition of an alloca kills the others.
+ */
+class ReachingStoresAnalysis : public GenKillAnalysis<true, true> {
+public:
+	ReachingStoresAnalysis(const std::vector<Instruction*>& defs, const std::map<Instruction*, AllocaInst*>& defToAlloca,
+						   const std::map<AllocaInst*, BitVector>& allocaDefs) :
+		Defs(defs), DefToAlloca(defToAlloca), AllocaDefs(allocaDefs)
+	{
+	}
+
+protected:
+	virtual void initializeDomain(Function* func, std::vector<unsigned>& Labels) override {
+		for (unsigned i = 0; i < Defs.size(); ++i) {
+			Labels.push_back(InstrToIndex[Defs[i]]);
+			DefBit[Defs[i]] = i;
+		}
+	}
+
+	virtual void getGenKill(Instruction* I, BitVector& Gen, BitVector& Kill) override {
+		auto def = DefBit.find(I);
+		if (def != DefBit.end()) {
+			Kill |= AllocaDefs.find(DefToAlloca.find(I)->second)->second;
+			Gen.set(def->second);
+		}
+	}
+
+private:
+	const std::vector<Instruction*>& Defs;
+	const std::map<Instruction*, AllocaInst*>& DefToAlloca;
+	const std::map<AllocaInst*, BitVector>& AllocaDefs;
+	std::map<Instruction*, unsigned> DefBit;
+};
+
+/*
+ * Constant propagation through memory, for code that keeps its variables in
+ * allocas. A load is replaced by a constant when every definition of its
+ * alloca that reaches it stores that constant. Instructions whose operands
+ * are then constant are folded, conditional branches and switches on a
+ * constant go straight to their target, and blocks no longer reachable are
+ * removed. Their stores no longer reach anything, so this is repeated until
+ * nothing changes.
+ *
+ * Only allocas that are loaded and stored directly, with their own type,
+ * take part: nothing else can write them.
+ */
+struct ConstantPropagationPass : public FunctionPass {
+	static char ID;
+	ConstantPropagationPass() : FunctionPass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage& AU) const override {
+		AU.addRequired<TargetLibraryInfoWrapperPass>();
+	}
+
+	virtual bool runOnFunction(Function& func) override {
+		const TargetLibraryInfo& TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+		unsigned numLoads = 0, numInstrs = 0, numBranches = 0, numBlocks = 0;
+		for (bool changed = true; changed; ) {
+			unsigned loads = foldLoads(func);
+			unsigned instrs = foldInstructions(func, TLI);
+			unsigned branches = 0;
+			for (BasicBlock& bBlock : func) {
+				branches += ConstantFoldTerminator(&bBlock, true);
+			}
+			unsigned blocks = func.size();
+			removeUnreachableBlocks(func);
+			blocks -= func.size();
+
+			numLoads += loads;
+			numInstrs += instrs;
+			numBranches += branches;
+			numBlocks += blocks;
+			changed = loads || instrs || branches || blocks;
+		}
+
+		errs() << func.getName() << ": folded " << numLoads << " loads and " << numInstrs << " instructions, resolved "
+			   << numBranches << " branches, removed " << numBlocks << " blocks\n";
+		return numLoads || numInstrs || numBranches || numBlocks;
+	}
+
+	unsigned foldLoads(Function& func) {
+		// Allocas used only as the address of their own type's loads and stores, and their definitions
+		std::vector<Instruction*> defs;
+		std::map<Instruction*, AllocaInst*> defToAlloca;
+		std::map<AllocaInst*, std::vector<LoadInst*>> allocaLoads;
+		for (Instruction& instr : func.getEntryBlock()) {
+			AllocaInst* alloca = dyn_cast<AllocaInst>(&instr);
+			if (!alloca || alloca->isArrayAllocation()) {
+				continue;
+			}
+			std::vector<Instruction*> stores;
+			std::vector<LoadInst*> loads;
+			bool direct = true;
+			for (User* user : alloca->users()) {
+				LoadInst* load = dyn_cast<LoadInst>(user);
+				StoreInst* store = dyn_cast<StoreInst>(user);
+				if (load && !load->isVolatile() && load->getType() == alloca->getAllocatedType()) {
+					loads.push_back(load);
+				}
+				else if (store && !store->isVolatile() && store->getPointerOperand() == alloca &&
+						 store->getValueOperand()->getType() == alloca->getAllocatedType()) {
+					stores.push_back(store);
+				}
+				else {
+					direct = false;
+					break;
+				}
+			}
+			if (!direct || loads.empty()) {
+				continue;
+			}
+			defs.push_back(alloca);
+			defToAlloca[alloca] = alloca;
+			for (Instruction* store : stores) {
+				defs.push_back(store);
+				defToAlloca[store] = alloca;
+			}
+			allocaLoads[alloca] = std::move(loads);
+		}
+		if (defs.empty()) {
+			return 0;
+		}
+
+		std::map<AllocaInst*, BitVector> allocaDefs;
+		for (unsigned i = 0; i < defs.size(); ++i) {
+			BitVector& mask = allocaDefs[defToAlloca[defs[i]]];
+			mask.resize(defs.size());
+			mask.set(i);
+		}
+
+		ReachingStoresAnalysis reaching(defs, defToAlloca, allocaDefs);
+		reaching.setCheckpointInterval(DFACheckpointInterval);
+		reaching.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		reaching.analyze(&func, false);
+
+		std::vector<std::pair<LoadInst*, Constant*>> folded;
+		for (auto& loads : allocaLoads) {
+			const BitVector& mask = allocaDefs[loads.first];
+			for (LoadInst* load : loads.second) {
+				BitVector reachingDefs = reaching.getBitsBefore(load);
+				reachingDefs &= mask;
+				// Nothing reaches unreachable code; the initial value is undefined
+				Constant* value = nullptr;
+				bool isConstant = reachingDefs.any();
+				for (int bit = reachingDefs.find_first(); isConstant && bit != -1; bit = reachingDefs.find_next(bit)) {
+					StoreInst* store = dyn_cast<StoreInst>(defs[bit]);
+					Constant* stored = store ? dyn_cast<Constant>(store->getValueOperand()) : nullptr;
+					isConstant = stored && (!value || value == stored);
+					value = stored;
+				}
+				if (isConstant) {
+					folded.push_back(std::make_pair(load, value));
+				}
+			}
+		}
+
+		for (auto& load : folded) {
+			load.first->replaceAllUsesWith(load.second);
+			load.first->eraseFromParent();
+		}
+		return folded.size();
+	}
+
+	unsigned foldInstructions(Function& func, const TargetLibraryInfo& TLI) {
+		const DataLayout& dataLayout = func.getParent()->getDataLayout();
+		unsigned numFolded = 0;
+		for (BasicBlock& bBlock : func) {
+			for (auto it = bBlock.begin(); it != bBlock.end(); ) {
+				Instruction* instr = &*it++;
+				if (instr->mayHaveSideEffects()) {
+					continue;
+				}
+				Constant* value = ConstantFoldInstruction(instr, dataLayout, &TLI);
+				if (value) {
+					instr->replaceAllUsesWith(value);
+					instr->eraseFromParent();
+					++numFolded;
+				}
+			}
+		}
+		return numFolded;
+	}
+};
+}
+
+char ConstantPropagationPass::ID = 0;
+static RegisterPass<ConstantPropagationPass> cse231_constprop(
+	"cse231-constprop",
+	"cse231-constprop",
+	false,
+	false);
+
+}
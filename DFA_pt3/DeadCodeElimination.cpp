@@ -0,0 +1,173 @@
+#include "LivenessAnalysis.h"
+#include "MayPointToAnalysis.h"
+#include "SlotLivenessAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+namespace {
+
+/*
+ * Removes
+ *   - instructions whose value is never live according to LivenessAnalysis, and
+ *   - stores to allocas that no load may read before the alloca is overwritten
+ *     or the function returns, according to SlotLivenessAnalysis over the
+ *     allocas whose address MayPointToAnalysis shows only reaches loads and stores.
+ * Both analyses are rerun until nothing changes, since every removal can make more code dead.
+ */
+struct DeadCodeEliminationPass : public FunctionPass {
+	static char ID;
+	DeadCodeEliminationPass() : FunctionPass(ID) {}
+
+	virtual bool runOnFunction(Function& func) override {
+		unsigned numDeadInstrs = 0, numDeadStores = 0;
+		for (bool changed = true; changed; ) {
+			unsigned deadStores = removeDeadStores(func);
+			unsigned deadInstrs = removeDeadInstructions(func);
+			numDeadStores += deadStores;
+			numDeadInstrs += deadInstrs;
+			changed = deadStores || deadInstrs;
+		}
+
+		errs() << func.getName() << ": removed " << numDeadInstrs << " dead instructions and "
+			   << numDeadStores << " dead stores\n";
+		return numDeadInstrs || numDeadStores;
+	}
+
+	unsigned removeDeadInstructions(Function& func) {
+		LivenessInfo bottom;
+		LivenessAnalysis liveness(bottom, bottom);
+		liveness.setCheckpointInterval(DFACheckpointInterval);
+		liveness.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		liveness.runWorklistAlgorithm(&func, false);
+
+		std::vector<Instruction*> deadInstrs;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			if (definesValue(instr) && !instr->mayHaveSideEffects() && !liveness.isLiveAfter(instr)) {
+				deadInstrs.push_back(instr);
+			}
+		}
+
+		// Remaining uses can only be in unreachable code or in other dead instructions
+		for (Instruction* instr : deadInstrs) {
+			instr->replaceAllUsesWith(UndefValue::get(instr->getType()));
+		}
+		for (Instruction* instr : deadInstrs) {
+			instr->eraseFromParent();
+		}
+		return deadInstrs.size();
+	}
+
+	unsigned removeDeadStores(Function& func) {
+		MayPointToInfo bottom;
+		MayPointToAnalysis pointTo(bottom, bottom);
+		pointTo.setCheckpointInterval(DFACheckpointInterval);
+		pointTo.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		pointTo.runWorklistAlgorithm(&func, false);
+
+		// The allocas a load may read, and the allocas whose address is used in
+		// any way the analysis does not follow (stored, passed, returned, ...)
+		std::map<Instruction*, std::unordered_set<unsigned>> loadPointees;
+		std::unordered_set<unsigned> exposedAllocas;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			if (isa<GetElementPtrInst>(instr) || isa<BitCastInst>(instr) ||
+				isa<PHINode>(instr) || isa<SelectInst>(instr)) {
+				continue;
+			}
+			for (Use& operand : instr->operands()) {
+				if (!operand->getType()->isPointerTy()) {
+					continue;
+				}
+				StoreInst* store = dyn_cast<StoreInst>(instr);
+				if (store && operand.getOperandNo() == store->getPointerOperandIndex()) {
+					continue;
+				}
+				std::unordered_set<unsigned> pointees = pointTo.getPointees(operand.get(), instr);
+				if (isa<LoadInst>(instr)) {
+					loadPointees[instr] = std::move(pointees);
+				}
+				else {
+					exposedAllocas.insert(pointees.cbegin(), pointees.cend());
+				}
+			}
+		}
+
+		// The allocas whose every read is a load, by bit
+		std::vector<AllocaInst*> slots;
+		std::map<unsigned, unsigned> slotBit;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			AllocaInst* alloca = dyn_cast<AllocaInst>(&*it);
+			if (alloca && !exposedAllocas.count(pointTo.getIndex(alloca))) {
+				slotBit[pointTo.getIndex(alloca)] = slots.size();
+				slots.push_back(alloca);
+			}
+		}
+		if (slots.empty()) {
+			return 0;
+		}
+
+		const DataLayout& dataLayout = func.getParent()->getDataLayout();
+		std::map<Instruction*, BitVector> loads;
+		for (auto& load : loadPointees) {
+			BitVector& bits = loads[load.first];
+			bits.resize(slots.size());
+			for (unsigned pointee : load.second) {
+				auto slot = slotBit.find(pointee);
+				if (slot != slotBit.end()) {
+					bits.set(slot->second);
+				}
+			}
+		}
+		// Only stores straight into an alloca; other pointers may have sources the analysis does not see
+		std::map<StoreInst*, unsigned> slotStores;
+		std::map<Instruction*, unsigned> kills;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			StoreInst* store = dyn_cast<StoreInst>(&*it);
+			AllocaInst* alloca = store ? dyn_cast<AllocaInst>(GetUnderlyingObject(store->getPointerOperand(), dataLayout)) : nullptr;
+			auto slot = slotBit.find(alloca ? pointTo.getIndex(alloca) : 0);
+			if (slot == slotBit.end()) {
+				continue;
+			}
+			if (!store->isVolatile()) {
+				slotStores[store] = slot->second;
+			}
+			if (store->getPointerOperand()->stripPointerCasts() == alloca && !alloca->isArrayAllocation() &&
+				dataLayout.getTypeStoreSize(store->getValueOperand()->getType()) >=
+				dataLayout.getTypeAllocSize(alloca->getAllocatedType())) {
+				kills[store] = slot->second;
+			}
+		}
+
+		SlotLivenessAnalysis liveness(slots, loads, kills);
+		liveness.setCheckpointInterval(DFACheckpointInterval);
+		liveness.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		liveness.analyze(&func, false);
+
+		// A store is dead if no load may read its alloca before it is overwritten or the function returns
+		std::vector<StoreInst*> deadStores;
+		for (auto& store : slotStores) {
+			if (!liveness.getBitsAfter(store.first).test(store.second)) {
+				deadStores.push_back(store.first);
+			}
+		}
+
+		for (StoreInst* store : deadStores) {
+			store->eraseFromParent();
+		}
+		return deadStores.size();
+	}
+};
+}
+
+char DeadCodeEliminationPass::ID = 0;
+static RegisterPass<DeadCodeEliminationPass> cse231_dce(
+	"cse231-dce",
+	"cse231-dce",
+	false,
+	false);
+
+}
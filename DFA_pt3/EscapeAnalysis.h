@@ -0,0 +1,153 @@
+#ifndef LLVM_TRANSFORMS_ESCAPEANALYSIS_H
+#define LLVM_TRANSFORMS_ESCAPEANALYSIS_H
+
+#include "MayPointToAnalysis.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+/*
+ * Finds the memory locations of a function (its allocas and the allocation
+ * sites given to MayPointToAnalysis) whose address may leave it. An address
+ * escapes when MayPointToAnalysis shows that it may reach
+ *   - a call argument, unless the callee doesn't capture it (memset,
+ *     memcpy; what is stored in the location still escapes then), or
+ *     free()/delete of exactly that location,
+ *   - a return,
+ *   - a store into memory other than the function's own locations, or into
+ *     a location that escapes itself, or
+ *   - anything else but a load or store address, getelementptr, bitcast,
+ *     phi, select or a lifetime marker (ptrtoint, comparisons, ...).
+ */
+class EscapeAnalysis {
+public:
+	EscapeAnalysis(MayPointToAnalysis& pointTo, const TargetLibraryInfo* TLI) :
+		PointTo(pointTo), TLI(TLI)
+	{
+	}
+
+	/*
+	 * Call it after pointTo.runWorklistAlgorithm().
+	 */
+	void analyze(Function& func) {
+		Escaped.clear();
+		Exposed.clear();
+		Releases.clear();
+		const DataLayout& dataLayout = func.getParent()->getDataLayout();
+
+		// Addresses stored into the function's own locations escape if one of those does
+		std::vector<std::pair<std::unordered_set<unsigned>, std::unordered_set<unsigned>>> storedInto;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			if (isa<GetElementPtrInst>(instr) || isa<BitCastInst>(instr) ||
+				isa<PHINode>(instr) || isa<SelectInst>(instr)) {
+				continue;
+			}
+			IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(instr);
+			if (intrinsic && (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+							  intrinsic->getIntrinsicID() == Intrinsic::lifetime_end)) {
+				continue;
+			}
+			if (isFreeCall(instr, TLI)) {
+				Instruction* freed = dyn_cast<Instruction>(instr->getOperand(0)->stripPointerCasts());
+				if (freed && isLocation(freed)) {
+					Releases[PointTo.getIndex(freed)].push_back(instr);
+					continue;
+				}
+			}
+
+			CallSite call(instr);
+			StoreInst* store = dyn_cast<StoreInst>(instr);
+			for (Use& operand : instr->operands()) {
+				if (!operand->getType()->isPointerTy()) {
+					continue;
+				}
+				if (isa<LoadInst>(instr) ||
+					(store && operand.getOperandNo() == store->getPointerOperandIndex())) {
+					continue;
+				}
+				std::unordered_set<unsigned> pointees = PointTo.getPointees(operand.get(), instr);
+				if (pointees.empty()) {
+					continue;
+				}
+				if (store && isLocalMemory(store->getPointerOperand(), dataLayout)) {
+					storedInto.emplace_back(PointTo.getPointees(store->getPointerOperand(), instr), std::move(pointees));
+					continue;
+				}
+				if (call && call.isArgOperand(&operand)) {
+					unsigned argNo = call.getArgumentNo(&operand);
+					if (call.doesNotCapture(argNo)) {
+						Exposed.insert(pointees.cbegin(), pointees.cend());
+						continue;
+					}
+				}
+				Escaped.insert(pointees.cbegin(), pointees.cend());
+			}
+		}
+
+		for (bool changed = true; changed; ) {
+			changed = false;
+			for (const auto& stored : storedInto) {
+				bool containerEscapes = false;
+				for (unsigned container : stored.first) {
+					containerEscapes |= Escaped.count(container) || Exposed.count(container);
+				}
+				for (unsigned pointee : stored.second) {
+					if (containerEscapes && Escaped.insert(pointee).second) {
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	 * Whether the memory allocated by site may be reached from outside the
+	 * function, or through a path the analysis does not follow.
+	 */
+	bool escapes(Instruction* site) const {
+		return Escaped.count(PointTo.getIndex(site)) != 0;
+	}
+
+	/*
+	 * The free()/delete calls that release exactly the memory of site.
+	 */
+	std::vector<Instruction*> getReleases(Instruction* site) const {
+		auto it = Releases.find(PointTo.getIndex(site));
+		return it == Releases.end() ? std::vector<Instruction*>() : it->second;
+	}
+
+private:
+	// Whether instr is an alloca or an allocation site, which point to themselves
+	bool isLocation(Instruction* instr) {
+		unsigned index = PointTo.getIndex(instr);
+		return index && !instr->isTerminator() && PointTo.getPointees(instr, instr->getNextNode()).count(index);
+	}
+
+	// Whether pointer can only point into the function's own locations
+	bool isLocalMemory(Value* pointer, const DataLayout& dataLayout) {
+		SmallVector<Value*, 4> objects;
+		GetUnderlyingObjects(pointer, objects, dataLayout);
+		for (Value* object : objects) {
+			Instruction* instr = dyn_cast<Instruction>(object);
+			if (!instr || !isLocation(instr)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	MayPointToAnalysis& PointTo;
+	const TargetLibraryInfo* TLI;
+	std::unordered_set<unsigned> Escaped;
+	// Locations whose contents a callee may read or overwrite
+	std::unordered_set<unsigned> Exposed;
+	std::map<unsigned, std::vector<Instruction*>> Releases;
+};
+
+}
+#endif // End LLVM_TRANSFORMS_ESCAPEANALYSIS_H
@@ -0,0 +1,146 @@
+#ifndef LLVM_TRANSFORMS_EXPRESSIONANALYSIS_H
+#define LLVM_TRANSFORMS_EXPRESSIONANALYSIS_H
+
+#include "231DFA.h"
+#include <tuple>
+
+namespace llvm {
+
+/*
+ * Gen/kill analysis over the expressions of a function: binary operators and compares.
+ *
+ * An operand that is a load is named by the address it loads from, so that the
+ * same expression over the same variables is recognized in -O0 code. A store
+ * or a call that may write such an address kills the expression. Distinct
+ * allocas never alias; any other pair of addresses may.
+ *
+ * An instruction only generates its expression if its loads still hold what
+ * is at their address: they are in its block, and nothing between them and it
+ * may write that address. Otherwise it computes with an older value than the
+ * expression names.
+ *
+ * print() shows an expression as the index of the first instruction computing it.
+ */
+template <bool Direction>
+class ExpressionAnalysis : public GenKillAnalysis<Direction, false> {
+public:
+	virtual ~ExpressionAnalysis() override = default;
+
+protected:
+	virtual void initializeDomain(Function* func, std::vector<unsigned>& Labels) override {
+		ExprToBit.clear();
+		InstrToBit.clear();
+		ExprAddresses.clear();
+		StaleInstrs.clear();
+
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			if (!isa<BinaryOperator>(instr) && !isa<CmpInst>(instr)) {
+				continue;
+			}
+			auto inserted = ExprToBit.insert(std::make_pair(getExpression(instr), (unsigned)Labels.size()));
+			if (inserted.second) {
+				Labels.push_back(this->InstrToIndex[instr]);
+				ExprAddresses.emplace_back();
+				for (Value* operand : instr->operands()) {
+					if (LoadInst* load = dyn_cast<LoadInst>(operand)) {
+						ExprAddresses.back().push_back(load->getPointerOperand());
+					}
+				}
+			}
+			InstrToBit[instr] = inserted.first->second;
+			if (hasStaleLoad(instr)) {
+				StaleInstrs.insert(instr);
+			}
+		}
+	}
+
+	virtual void getGenKill(Instruction* I, BitVector& Gen, BitVector& Kill) override {
+		if (I->mayWriteToMemory()) {
+			// Only the address of a store is known; anything else may write anywhere
+			StoreInst* store = dyn_cast<StoreInst>(I);
+			Value* address = store ? store->getPointerOperand() : nullptr;
+			for (unsigned bit = 0; bit < ExprAddresses.size(); ++bit) {
+				for (Value* exprAddress : ExprAddresses[bit]) {
+					if (mayAlias(exprAddress, address)) {
+						Kill.set(bit);
+						break;
+					}
+				}
+			}
+		}
+
+		auto it = InstrToBit.find(I);
+		if (it != InstrToBit.end() && !StaleInstrs.count(I)) {
+			Gen.set(it->second);
+		}
+	}
+
+private:
+	// (value or loaded address, whether it is a loaded address)
+	typedef std::pair<Value*, bool> Operand;
+	// (opcode, compare predicate, left operand, right operand)
+	typedef std::tuple<unsigned, unsigned, Operand, Operand> Expression;
+
+	static Operand getOperand(Value* value) {
+		LoadInst* load = dyn_cast<LoadInst>(value);
+		if (load && !load->isVolatile()) {
+			return std::make_pair(load->getPointerOperand(), true);
+		}
+		return std::make_pair(value, false);
+	}
+
+	static Expression getExpression(Instruction* I) {
+		Operand lhs = getOperand(I->getOperand(0)), rhs = getOperand(I->getOperand(1));
+		if (I->isCommutative() && rhs < lhs) {
+			std::swap(lhs, rhs);
+		}
+		CmpInst* cmp = dyn_cast<CmpInst>(I);
+		return std::make_tuple(I->getOpcode(), cmp ? (unsigned)cmp->getPredicate() : 0u, lhs, rhs);
+	}
+
+	// Whether a load operand of I may have read an older value than its address now holds
+	static bool hasStaleLoad(Instruction* I) {
+		for (Value* operand : I->operands()) {
+			LoadInst* load = dyn_cast<LoadInst>(operand);
+			if (!load || load->isVolatile()) {
+				continue;
+			}
+			if (load->getParent() != I->getParent()) {
+				return true;
+			}
+			for (Instruction* between = load->getNextNode(); between != I; between = between->getNextNode()) {
+				if (!between->mayWriteToMemory()) {
+					continue;
+				}
+				StoreInst* store = dyn_cast<StoreInst>(between);
+				if (mayAlias(load->getPointerOperand(), store ? store->getPointerOperand() : nullptr)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	static bool mayAlias(Value* address1, Value* address2) {
+		if (!address1 || !address2 || address1 == address2) {
+			return true;
+		}
+		return !isa<AllocaInst>(address1) || !isa<AllocaInst>(address2);
+	}
+
+	std::map<Expression, unsigned> ExprToBit;
+	std::map<Instruction*, unsigned> InstrToBit;
+	// The addresses loaded by the operands of each expression
+	std::vector<std::vector<Value*>> ExprAddresses;
+	// The instructions that don't generate their expression
+	std::unordered_set<Instruction*> StaleInstrs;
+};
+
+// An expression is available on an edge if every path to it computes the expression and does not kill it afterwards.
+typedef ExpressionAnalysis<true> AvailableExpressionsAnalysis;
+// An expression is very busy on an edge if every path from it computes the expression before killing it.
+typedef ExpressionAnalysis<false> VeryBusyExpressionsAnalysis;
+
+}
+#endif // End LLVM_TRANSFORMS_EXPRESSIONANALYSIS_H
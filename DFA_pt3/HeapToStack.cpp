@@ -0,0 +1,121 @@
+#include "EscapeAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+
+namespace llvm {
+
+static cl::opt<unsigned> MaxPromotedSize(
+	"heap2stack-max-size",
+	cl::desc("Largest malloc/new in bytes that cse231-heap2stack moves to the stack"),
+	cl::init(1024));
+
+namespace {
+
+/*
+ * Replaces malloc() and operator new calls of a constant size by allocas
+ * when EscapeAnalysis shows that the memory never leaves the function, and
+ * removes the free()/delete calls that release it. Calls inside a loop are
+ * left alone: every iteration needs its own memory. Every allocation site
+ * is reported, with the reason it was kept on the heap.
+ */
+struct HeapToStackPass : public FunctionPass {
+	static char ID;
+	HeapToStackPass() : FunctionPass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage& AU) const override {
+		AU.addRequired<TargetLibraryInfoWrapperPass>();
+		AU.addRequired<LoopInfoWrapperPass>();
+	}
+
+	virtual bool runOnFunction(Function& func) override {
+		const TargetLibraryInfo& TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+		LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+		std::vector<CallInst*> sites;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			CallInst* call = dyn_cast<CallInst>(&*it);
+			// Only malloc(size), new(size) and new[](size): the nothrow and aligned forms take more
+			if (call && isMallocLikeFn(call, &TLI) && call->getNumArgOperands() == 1) {
+				sites.push_back(call);
+			}
+		}
+		if (sites.empty()) {
+			return false;
+		}
+
+		MayPointToInfo bottom;
+		MayPointToAnalysis pointTo(bottom, bottom);
+		pointTo.setCheckpointInterval(DFACheckpointInterval);
+		pointTo.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		pointTo.setAllocationSites(std::unordered_set<Instruction*>(sites.begin(), sites.end()));
+		pointTo.runWorklistAlgorithm(&func, false);
+		EscapeAnalysis escape(pointTo, &TLI);
+		escape.analyze(func);
+
+		std::vector<std::string> report;
+		std::vector<CallInst*> promoted;
+		uint64_t numBytes = 0;
+		for (CallInst* site : sites) {
+			std::string line;
+			raw_string_ostream os(line);
+			os << "  " << (site->hasName() ? site->getName() : "<unnamed>") << " = " << site->getCalledFunction()->getName();
+			ConstantInt* size = dyn_cast<ConstantInt>(site->getArgOperand(0));
+			if (size) {
+				os << '(' << size->getZExtValue() << ')';
+			}
+			os << ": ";
+			if (!size) {
+				os << "variable size";
+			}
+			else if (size->getZExtValue() > MaxPromotedSize) {
+				os << "too large";
+			}
+			else if (LI.getLoopFor(site->getParent())) {
+				os << "in a loop";
+			}
+			else if (escape.escapes(site)) {
+				os << "escapes";
+			}
+			else {
+				os << "promoted";
+				promoted.push_back(site);
+				numBytes += size->getZExtValue();
+			}
+			report.push_back(os.str());
+		}
+
+		for (CallInst* site : promoted) {
+			for (Instruction* release : escape.getReleases(site)) {
+				release->eraseFromParent();
+			}
+			uint64_t size = cast<ConstantInt>(site->getArgOperand(0))->getZExtValue();
+			// What malloc() and operator new guarantee on common 64-bit targets
+			const unsigned alignment = 16;
+			AllocaInst* alloca = new AllocaInst(ArrayType::get(Type::getInt8Ty(func.getContext()), size), 0, nullptr,
+												alignment, "", &*func.getEntryBlock().getFirstInsertionPt());
+			Instruction* cast = new BitCastInst(alloca, site->getType(), "", site);
+			cast->takeName(site);
+			site->replaceAllUsesWith(cast);
+			site->eraseFromParent();
+		}
+
+		errs() << func.getName() << ": promoted " << promoted.size() << " of " << sites.size()
+			   << " heap allocations to the stack, " << numBytes << " bytes\n";
+		for (const std::string& line : report) {
+			errs() << line << '\n';
+		}
+		return !promoted.empty();
+	}
+};
+}
+
+char HeapToStackPass::ID = 0;
+static RegisterPass<HeapToStackPass> cse231_heap2stack(
+	"cse231-heap2stack",
+	"cse231-heap2stack",
+	false,
+	false);
+
+}
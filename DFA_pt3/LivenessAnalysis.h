@@ -0,0 +1,181 @@
+#ifndef LLVM_TRANSFORMS_LIVENESSANALYSIS_H
+#define LLVM_TRANSFORMS_LIVENESSANALYSIS_H
+
+#include "231DFA.h"
+
+namespace llvm {
+
+class LivenessInfo : public Info {
+public:
+	LivenessInfo() = default;
+	LivenessInfo(const LivenessInfo& other) :
+		Info(other),
+		insts(other.insts)
+	{
+	}
+	virtual ~LivenessInfo() override = default;
+
+	/*
+	 * Compare two pieces of information
+	 *
+	 * Direction:
+	 *   In your subclass you need to implement this function.
+	 */
+	static bool equals(LivenessInfo* info1, LivenessInfo* info2) {
+		return info1->insts == info2->insts;
+	}
+	/*
+	 * Join two pieces of information.
+	 * The third parameter points to the result.
+	 *
+	 * Direction:
+	 *   In your subclass you need to implement this function.
+	 */
+	static void join(LivenessInfo* info1, LivenessInfo* info2, LivenessInfo* result) {
+		if (!result) {
+			return;
+		}
+		std::unordered_set<unsigned> temp;
+		if (info1) {
+			temp.insert(info1->insts.cbegin(), info1->insts.cend());
+		}
+		if (info2) {
+			temp.insert(info2->insts.cbegin(), info2->insts.cend());
+		}
+		result->insts = std::move(temp);
+	}
+
+	static std::size_t hash(LivenessInfo* info) {
+		return hashIndexSet(info->insts);
+	}
+
+	/*
+	* Print out the information
+	*
+	* Direction:
+	*   In your subclass you should implement this function according to the project specifications.
+	*/
+	virtual void print() override {
+		for (unsigned index : insts) {
+			errs() << index << '|';
+		}
+		errs() << '\n';
+	}
+
+	std::unordered_set<unsigned> insts;
+};
+
+class LivenessAnalysis : public DataFlowAnalysis<LivenessInfo, false> {
+public:
+	LivenessAnalysis(LivenessInfo& bottom, LivenessInfo& initialState) :
+		DataFlowAnalysis<LivenessInfo, false>(bottom, initialState)
+	{
+	}
+
+	virtual ~LivenessAnalysis() override = default;
+
+	/*
+	 * Whether the value defined by I is live right after I.
+	 * Call it after runWorklistAlgorithm().
+	 */
+	bool isLiveAfter(Instruction* I) {
+		// Only the first phi node of a block has edges
+		Instruction* node = isa<PHINode>(I) ? &I->getParent()->front() : I;
+		unsigned index = InstrToIndex[node];
+		std::vector<unsigned> incomingEdges;
+		getIncomingEdges(index, &incomingEdges);
+		for (unsigned preIndex : incomingEdges) {
+			if (getEdgeInfo(preIndex, index)->insts.count(InstrToIndex[I])) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * The values live right after I, after all the phi nodes of its block if
+	 * I is one. Call it after runWorklistAlgorithm().
+	 */
+	std::vector<Instruction*> getLiveAfter(Instruction* I) {
+		Instruction* node = isa<PHINode>(I) ? &I->getParent()->front() : I;
+		unsigned index = InstrToIndex[node];
+		std::vector<unsigned> incomingEdges;
+		getIncomingEdges(index, &incomingEdges);
+		std::unordered_set<unsigned> live;
+		for (unsigned preIndex : incomingEdges) {
+			const auto& insts = getEdgeInfo(preIndex, index)->insts;
+			live.insert(insts.cbegin(), insts.cend());
+		}
+		std::vector<Instruction*> liveInstrs;
+		for (unsigned liveIndex : live) {
+			liveInstrs.push_back(IndexToInstr[liveIndex]);
+		}
+		return liveInstrs;
+	}
+
+private:
+	virtual void flowfunction(Instruction* I,
+							  std::vector<unsigned>& IncomingEdges,
+							  std::vector<unsigned>& OutgoingEdges,
+							  std::vector<LivenessInfo*>& Infos) override
+	{
+		if (!I) {
+			return;
+		}
+		unsigned curIndex = InstrToIndex[I];
+		LivenessInfo outInfo(*joinIncomingInfos(curIndex, IncomingEdges));
+
+		if (!isa<PHINode>(I)) {
+			for (auto opIter = I->op_begin(); opIter != I->op_end(); ++opIter) {
+				Value* val = opIter->get();
+				if (isa<Instruction>(val)) {
+					Instruction* pInstr = cast<Instruction>(val);
+					if (InstrToIndex.count(pInstr)) {
+						outInfo.insts.insert(InstrToIndex[pInstr]);
+					}
+				}
+			}
+			if (definesValue(I)) {
+				outInfo.insts.erase(InstrToIndex[I]);
+			}
+			for (unsigned nexIndex : OutgoingEdges) {
+				Infos.push_back(new LivenessInfo);
+				Edge outgoingEdge = std::make_pair(curIndex, nexIndex);
+				LivenessInfo::join(&outInfo, EdgeToInfo[outgoingEdge], Infos.back());
+			}
+		}
+		else {
+			for (auto pInstr = I; isa<PHINode>(pInstr); pInstr = pInstr->getNextNode()) {
+				outInfo.insts.erase(InstrToIndex[pInstr]);
+				if (pInstr->isTerminator()) {
+					break;
+				}
+			}
+			for (unsigned nexIndex : OutgoingEdges) {
+				Instruction* nexInstr = IndexToInstr[nexIndex];
+				Infos.push_back(new LivenessInfo);
+				Edge outgoingEdge{ curIndex,nexIndex };
+				LivenessInfo::join(&outInfo, EdgeToInfo[outgoingEdge], Infos.back());
+
+				for (auto pInstr = I; isa<PHINode>(pInstr); pInstr = pInstr->getNextNode()) {
+					PHINode* phi = cast<PHINode>(pInstr);
+					for (unsigned k = 0; k < phi->getNumIncomingValues(); ++k) {
+						if (phi->getIncomingBlock(k) == nexInstr->getParent() && isa<Instruction>(phi->getIncomingValue(k))) {
+							Instruction* val = cast<Instruction>(phi->getIncomingValue(k));
+							Infos.back()->insts.insert(InstrToIndex[val]);
+						}
+					}
+					if (pInstr->isTerminator()) {
+						break;
+					}
+				}
+				
+			}
+		}
+
+	}
+
+};
+
+}
+#endif // End LLVM_TRANSFORMS_LIVENESSANALYSIS_H
@@ -0,0 +1,218 @@
+#ifndef LLVM_TRANSFORMS_MAYPOINTTOANALYSIS_H
+#define LLVM_TRANSFORMS_MAYPOINTTOANALYSIS_H
+
+#include "231DFA.h"
+
+namespace llvm {
+
+class MayPointToInfo : public Info {
+public:
+	MayPointToInfo() = default;
+	MayPointToInfo(const MayPointToInfo& other) :
+		Info(other),
+		pointTo(other.pointTo)
+	{
+	}
+	virtual ~MayPointToInfo() override = default;
+	/*
+	* Print out the information
+	*
+	* Direction:
+	*   In your subclass you should implement this function according to the project specifications.
+	*/
+	virtual void print() override {
+		for (const auto& item : pointTo) {
+			if (!item.second.empty()) {
+				errs() << item.first.first << item.first.second << "->(";
+				for (unsigned pte : item.second) {
+					errs() << 'M' << pte << '/';
+				}
+				errs() << ")|";
+			}
+		}
+		errs() << '\n';
+	}
+
+	/*
+	 * Compare two pieces of information
+	 *
+	 * Direction:
+	 *   In your subclass you need to implement this function.
+	 */
+	static bool equals(MayPointToInfo* info1, MayPointToInfo* info2) {
+		return (!info1 && !info2) ||
+		       (info1 && info2 && info1->pointTo == info2->pointTo);
+	}
+	/*
+	 * Join two pieces of information.
+	 * The third parameter points to the result.
+	 *
+	 * Direction:
+	 *   In your subclass you need to implement this function.
+	 */
+	static void join(MayPointToInfo* info1, MayPointToInfo* info2, MayPointToInfo* result) {
+		if (!result) {
+			return;
+		}
+		// The pointees of a key present in both infos are merged
+		std::map<std::pair<char, unsigned>, std::unordered_set<unsigned>> temp_pointTo;
+		for (MayPointToInfo* info : { info1, info2 }) {
+			if (info) {
+				for (const auto& item : info->pointTo) {
+					temp_pointTo[item.first].insert(item.second.cbegin(), item.second.cend());
+				}
+			}
+		}
+		result->pointTo = std::move(temp_pointTo);
+	}
+
+	static std::size_t hash(MayPointToInfo* info) {
+		hash_code result = hash_value(info->pointTo.size());
+		for (const auto& item : info->pointTo) {
+			result = hash_combine(result, item.first.first, item.first.second, hashIndexSet(item.second));
+		}
+		return result;
+	}
+
+	std::map<std::pair<char, unsigned>, std::unordered_set<unsigned>> pointTo;
+};
+
+class MayPointToAnalysis : public DataFlowAnalysis<MayPointToInfo, true> {
+public:
+	MayPointToAnalysis(MayPointToInfo& bottom, MayPointToInfo& initialState) :
+		DataFlowAnalysis<MayPointToInfo, true>(bottom, initialState)
+	{
+	}
+
+	virtual ~MayPointToAnalysis() override = default;
+
+	/*
+	 * Calls to treat like allocas: each one returns a pointer to its own
+	 * memory location, numbered with its index. Call it before runWorklistAlgorithm().
+	 */
+	void setAllocationSites(const std::unordered_set<Instruction*>& sites) {
+		AllocationSites = sites;
+	}
+
+	/*
+	 * The allocas (by index) that pointer may point to right before I.
+	 * Values the analysis does not track point to nothing.
+	 * Call it after runWorklistAlgorithm().
+	 */
+	std::unordered_set<unsigned> getPointees(Value* pointer, Instruction* I) {
+		std::unordered_set<unsigned> pointees;
+		Instruction* pointerInstr = dyn_cast<Instruction>(pointer);
+		if (!pointerInstr || !InstrToIndex.count(pointerInstr)) {
+			return pointees;
+		}
+		// Only the first phi node of a block has edges
+		Instruction* node = isa<PHINode>(I) ? &I->getParent()->front() : I;
+		unsigned index = InstrToIndex[node];
+		std::vector<unsigned> incomingEdges;
+		getIncomingEdges(index, &incomingEdges);
+		for (unsigned preIndex : incomingEdges) {
+			const auto& pointTo = getEdgeInfo(preIndex, index)->pointTo;
+			auto it = pointTo.find({ 'R',InstrToIndex[pointerInstr] });
+			if (it != pointTo.end()) {
+				pointees.insert(it->second.cbegin(), it->second.cend());
+			}
+		}
+		return pointees;
+	}
+
+private:
+	std::unordered_set<Instruction*> AllocationSites;
+
+	/*
+	 * The index of an operand, or 0 if the analysis does not track it
+	 * (arguments, globals, constants). Nothing points to anything through index 0.
+	 */
+	unsigned getOperandIndex(Value* operand) {
+		Instruction* instr = dyn_cast<Instruction>(operand);
+		if (!instr) {
+			return 0;
+		}
+		auto it = InstrToIndex.find(instr);
+		return it == InstrToIndex.end() ? 0 : it->second;
+	}
+
+	virtual void flowfunction(Instruction* I,
+							  std::vector<unsigned>& IncomingEdges,
+							  std::vector<unsigned>& OutgoingEdges,
+							  std::vector<MayPointToInfo*>& Infos) override
+	{
+		if (!I) {
+			return;
+		}
+
+		unsigned curIndex = InstrToIndex[I];
+		MayPointToInfo outInfo(*joinIncomingInfos(curIndex, IncomingEdges));
+		auto& pointTo_info = outInfo.pointTo;
+
+		unsigned opcode = I->getOpcode();
+
+		if (opcode == Instruction::Alloca || AllocationSites.count(I)) {
+			pointTo_info[{ 'R',curIndex }].insert(curIndex);
+		}
+		else if (opcode == Instruction::BitCast || opcode == Instruction::GetElementPtr) {
+			unsigned Rv = getOperandIndex(I->getOperand(0));
+			const auto& pointees = pointTo_info[{ 'R',Rv }];
+			pointTo_info[{ 'R',curIndex }].insert(pointees.cbegin(), pointees.cend());
+		}
+		else if (opcode == Instruction::Load) {
+			LoadInst* loadInstr = cast<LoadInst>(I);
+			unsigned Rp = getOperandIndex(loadInstr->getPointerOperand());
+
+			for (unsigned X : pointTo_info[{ 'R',Rp }]) {
+				const auto& Ys = pointTo_info[{ 'M',X }];
+				pointTo_info[{ 'R',curIndex }].insert(Ys.cbegin(), Ys.cend());
+			}
+		}
+		else if (opcode == Instruction::Store) {
+			StoreInst* storeInstr = cast<StoreInst>(I);
+			unsigned Rv = getOperandIndex(storeInstr->getValueOperand());
+			unsigned Rp = getOperandIndex(storeInstr->getPointerOperand());
+			const auto& Xs = pointTo_info[{ 'R',Rv }];
+
+			for (unsigned Y : pointTo_info[{ 'R',Rp }]) {
+				pointTo_info[{ 'M',Y }].insert(Xs.cbegin(), Xs.cend());
+			}
+		}
+		else if (opcode == Instruction::Select) {
+			SelectInst* selectInstr = cast<SelectInst>(I);
+			unsigned R1 = getOperandIndex(selectInstr->getTrueValue());
+			const auto& Xs1 = pointTo_info[{ 'R',R1 }];
+			pointTo_info[{ 'R',curIndex }].insert(Xs1.cbegin(), Xs1.cend());
+
+			unsigned R2 = getOperandIndex(selectInstr->getFalseValue());
+			const auto& Xs2 = pointTo_info[{ 'R',R2 }];
+			pointTo_info[{ 'R',curIndex }].insert(Xs2.cbegin(), Xs2.cend());
+		}
+		else if (opcode == Instruction::PHI) {
+			for (auto pInstr = I; isa<PHINode>(pInstr); pInstr = pInstr->getNextNode()) {
+				PHINode* phi = cast<PHINode>(pInstr);
+				unsigned Rphi = InstrToIndex[phi];
+				for (unsigned k = 0; k < phi->getNumIncomingValues(); ++k) {
+					unsigned Rk = getOperandIndex(phi->getIncomingValue(k));
+					if (Rk == Rphi) {
+						continue;
+					}
+					const auto& Xs = pointTo_info[{ 'R',Rk }];
+					pointTo_info[{ 'R',Rphi }].insert(Xs.cbegin(), Xs.cend());
+				}
+				if (pInstr->isTerminator()) {
+					break;
+				}
+			}
+		}
+		for (unsigned nexIndex : OutgoingEdges) {
+			Edge outgoingEdge{ curIndex,nexIndex };
+			Infos.push_back(new MayPointToInfo);
+			MayPointToInfo::join(&outInfo, EdgeToInfo[outgoingEdge], Infos.back());
+		}
+	}
+
+};
+
+}
+#endif // End LLVM_TRANSFORMS_MAYPOINTTOANALYSIS_H
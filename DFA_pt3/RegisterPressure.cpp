@@ -0,0 +1,221 @@
+#include "llvm/ADT/BitVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+
+namespace llvm {
+
+static cl::opt<unsigned> TargetRegisters(
+	"regpressure-target",
+	cl::desc("Registers the target has for values; regions needing more are flagged"),
+	cl::init(16));
+
+static cl::opt<unsigned> ReportTop(
+	"regpressure-top",
+	cl::desc("Print only the first N regions of the ranking (0: all)"),
+	cl::init(0));
+
+namespace {
+
+/*
+ * Estimates the register pressure of every basic block and loop: the number
+ * of values live after each instruction, with the maximum and the average
+ * over the instructions of the region. At exit the regions of the module
+ * are ranked by their maximum, and those above -regpressure-target are
+ * flagged as likely to spill.
+ *
+ * The liveness is SSA liveness computed here: a value is live from its
+ * definition to its last use, and a phi uses its operand at the end of the
+ * incoming block. LivenessAnalysis is not used: it never kills the
+ * values it doesn't define, such as calls and casts, which then stay live
+ * around every loop they are used in.
+ *
+ * Allocas are frame addresses rather than registers and are not counted;
+ * neither are function arguments.
+ */
+struct RegisterPressurePass : public FunctionPass {
+	static char ID;
+	RegisterPressurePass() : FunctionPass(ID) {}
+
+	struct Region {
+		std::string Function;
+		std::string Name;
+		unsigned Max;
+		double Average;
+	};
+
+	virtual void getAnalysisUsage(AnalysisUsage& AU) const override {
+		AU.addRequired<LoopInfoWrapperPass>();
+		AU.setPreservesAll();
+	}
+
+	virtual bool doInitialization(Module& module) override {
+		Regions.clear();
+		return false;
+	}
+
+	virtual bool runOnFunction(Function& func) override {
+		LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+		// the values that take a register, by bit
+		std::map<Instruction*, unsigned> valueBit;
+		for (BasicBlock& bBlock : func) {
+			for (Instruction& instr : bBlock) {
+				if (!instr.getType()->isVoidTy() && !isa<AllocaInst>(instr)) {
+					valueBit.insert(std::make_pair(&instr, (unsigned)valueBit.size()));
+				}
+			}
+		}
+		std::map<BasicBlock*, BitVector> liveOut = computeLiveOut(func, valueBit);
+
+		// max and sum of the live values over the program points of each block
+		std::map<BasicBlock*, std::pair<unsigned, unsigned>> pressure;
+		std::map<BasicBlock*, unsigned> numPoints;
+		unsigned blockIndex = 0;
+		for (BasicBlock& bBlock : func) {
+			unsigned maxLive = 0, sumLive = 0, points = 0;
+			BitVector live = liveOut[&bBlock];
+			for (auto it = bBlock.rbegin(); it != bBlock.rend(); ++it) {
+				Instruction* instr = &*it;
+				// the phi nodes of a block are one program point, after the last of them
+				if (!isa<PHINode>(instr) || !isa<PHINode>(instr->getNextNode())) {
+					unsigned count = live.count();
+					maxLive = std::max(maxLive, count);
+					sumLive += count;
+					++points;
+				}
+				transferBackward(instr, live, valueBit);
+			}
+			pressure[&bBlock] = std::make_pair(maxLive, sumLive);
+			numPoints[&bBlock] = points;
+			std::string name = bBlock.hasName() ? bBlock.getName().str() : "bb" + std::to_string(blockIndex);
+			Regions.push_back(Region{ func.getName().str(), "block " + name, maxLive, points ? double(sumLive) / points : 0.0 });
+			++blockIndex;
+		}
+
+		for (Loop* loop : LI.getLoopsInPreorder()) {
+			unsigned maxLive = 0, sumLive = 0, points = 0;
+			for (BasicBlock* bBlock : loop->blocks()) {
+				maxLive = std::max(maxLive, pressure[bBlock].first);
+				sumLive += pressure[bBlock].second;
+				points += numPoints[bBlock];
+			}
+			BasicBlock* header = loop->getHeader();
+			std::string name = header->hasName() ? header->getName().str() : "bb" + std::to_string(getBlockIndex(header));
+			Regions.push_back(Region{ func.getName().str(), "loop " + name + " depth " + std::to_string(loop->getLoopDepth()),
+				maxLive, points ? double(sumLive) / points : 0.0 });
+		}
+		return false;
+	}
+
+	virtual bool doFinalization(Module& module) override {
+		std::stable_sort(Regions.begin(), Regions.end(), [](const Region& a, const Region& b) {
+			return a.Max != b.Max ? a.Max > b.Max : a.Average > b.Average;
+		});
+		unsigned numOver = 0;
+		for (const Region& region : Regions) {
+			numOver += region.Max > TargetRegisters;
+		}
+		errs() << "cse231-regpressure: " << numOver << " of " << Regions.size() << " regions need more than "
+			   << TargetRegisters << " registers\n";
+		errs() << "function\tregion\tmax\taverage\n";
+		for (unsigned i = 0; i < Regions.size() && (ReportTop == 0 || i < ReportTop); ++i) {
+			const Region& region = Regions[i];
+			errs() << region.Function << '\t' << region.Name << '\t' << region.Max << '\t' << format("%.2f", region.Average);
+			if (region.Max > TargetRegisters) {
+				errs() << "\tspills";
+			}
+			errs() << '\n';
+		}
+		Regions.clear();
+		return false;
+	}
+
+private:
+	/*
+	 * live: the values live right after instr, turned into those live right
+	 * before it. The operands of a phi are not used here but in its
+	 * incoming blocks.
+	 */
+	static void transferBackward(Instruction* instr, BitVector& live, const std::map<Instruction*, unsigned>& valueBit) {
+		auto def = valueBit.find(instr);
+		if (def != valueBit.end()) {
+			live.reset(def->second);
+		}
+		if (isa<PHINode>(instr)) {
+			return;
+		}
+		for (Value* operand : instr->operands()) {
+			auto use = valueBit.find(dyn_cast<Instruction>(operand));
+			if (use != valueBit.end()) {
+				live.set(use->second);
+			}
+		}
+	}
+
+	/*
+	 * The values live at the end of each block: a backward analysis over the
+	 * blocks, iterated until nothing changes.
+	 */
+	static std::map<BasicBlock*, BitVector> computeLiveOut(Function& func, const std::map<Instruction*, unsigned>& valueBit) {
+		std::map<BasicBlock*, BitVector> liveIn, liveOut;
+		for (BasicBlock& bBlock : func) {
+			liveIn[&bBlock].resize(valueBit.size());
+			liveOut[&bBlock].resize(valueBit.size());
+		}
+		for (bool changed = true; changed; ) {
+			changed = false;
+			for (auto blockIter = func.getBasicBlockList().rbegin(); blockIter != func.getBasicBlockList().rend(); ++blockIter) {
+				BasicBlock* bBlock = &*blockIter;
+				BitVector live(valueBit.size());
+				for (BasicBlock* succ : successors(bBlock)) {
+					live |= liveIn[succ];
+					for (PHINode& phi : succ->phis()) {
+						auto use = valueBit.find(dyn_cast<Instruction>(phi.getIncomingValueForBlock(bBlock)));
+						if (use != valueBit.end()) {
+							live.set(use->second);
+						}
+					}
+				}
+				liveOut[bBlock] = live;
+				for (auto it = bBlock->rbegin(); it != bBlock->rend(); ++it) {
+					transferBackward(&*it, live, valueBit);
+				}
+				if (live != liveIn[bBlock]) {
+					liveIn[bBlock] = live;
+					changed = true;
+				}
+			}
+		}
+		return liveOut;
+	}
+
+	static unsigned getBlockIndex(BasicBlock* bBlock) {
+		unsigned index = 0;
+		for (BasicBlock& other : *bBlock->getParent()) {
+			if (&other == bBlock) {
+				break;
+			}
+			++index;
+		}
+		return index;
+	}
+
+	std::vector<Region> Regions;
+};
+}
+
+char RegisterPressurePass::ID = 0;
+static RegisterPass<RegisterPressurePass> cse231_regpressure(
+	"cse231-regpressure",
+	"cse231-regpressure",
+	false,
+	true);
+
+}
@@ -0,0 +1,51 @@
+#ifndef LLVM_TRANSFORMS_SLOTLIVENESSANALYSIS_H
+#define LLVM_TRANSFORMS_SLOTLIVENESSANALYSIS_H
+
+#include "231DFA.h"
+
+namespace llvm {
+
+/*
+ * The slots whose contents may be read later: a backward gen/kill analysis
+ * over a set of allocas. A load generates the allocas its address may
+ * point to; a store straight into an alloca that covers all of it kills it.
+ * The caller works both out, usually with MayPointToAnalysis.
+ *   loads: the bits of the slots each load may read
+ *   kills: the bit of the slot each store overwrites entirely
+ */
+class SlotLivenessAnalysis : public GenKillAnalysis<false, true> {
+public:
+	SlotLivenessAnalysis(const std::vector<AllocaInst*>& slots,
+						 const std::map<Instruction*, BitVector>& loads,
+						 const std::map<Instruction*, unsigned>& kills) :
+		Slots(slots), Loads(loads), Kills(kills)
+	{
+	}
+
+protected:
+	virtual void initializeDomain(Function* func, std::vector<unsigned>& Labels) override {
+		for (AllocaInst* slot : Slots) {
+			Labels.push_back(InstrToIndex[slot]);
+		}
+	}
+
+	virtual void getGenKill(Instruction* I, BitVector& Gen, BitVector& Kill) override {
+		auto load = Loads.find(I);
+		if (load != Loads.end()) {
+			Gen |= load->second;
+		}
+		auto kill = Kills.find(I);
+		if (kill != Kills.end()) {
+			Kill.set(kill->second);
+		}
+	}
+
+private:
+	const std::vector<AllocaInst*>& Slots;
+	const std::map<Instruction*, BitVector>& Loads;
+	const std::map<Instruction*, unsigned>& Kills;
+};
+
+}
+
+#endif
@@ -0,0 +1,283 @@
+#include "MayPointToAnalysis.h"
+#include "SlotLivenessAnalysis.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+namespace {
+
+/*
+ * The slots that may have been written: a forward gen/kill analysis in
+ * which a store generates the allocas its address may point to.
+ */
+class WrittenSlotsAnalysis : public GenKillAnalysis<true, true> {
+public:
+	WrittenSlotsAnalysis(const std::vector<AllocaInst*>& slots, const std::map<Instruction*, BitVector>& stores) :
+		Slots(slots), Stores(stores)
+	{
+	}
+
+protected:
+	virtual void initializeDomain(Function* func, std::vector<unsigned>& Labels) override {
+		for (AllocaInst* slot : Slots) {
+			Labels.push_back(InstrToIndex[slot]);
+		}
+	}
+
+	virtual void getGenKill(Instruction* I, BitVector& Gen, BitVector& Kill) override {
+		auto store = Stores.find(I);
+		if (store != Stores.end()) {
+			Gen |= store->second;
+		}
+	}
+
+private:
+	const std::vector<AllocaInst*>& Slots;
+	const std::map<Instruction*, BitVector>& Stores;
+};
+
+/*
+ * Merges the static allocas of a function whose contents are never needed
+ * at the same time into shared [N x i8] slots, and reports the stack bytes
+ * saved. An alloca takes part if MayPointToAnalysis shows that its address
+ * only reaches loads, stores and lifetime markers, through getelementptr,
+ * bitcast, phi and select; comparing, storing or passing it on could tell
+ * the merged slots apart. Two allocas conflict if, right after some
+ * instruction, both may have been written and both may still be read.
+ * The allocas are packed greedily, largest first.
+ */
+struct StackSlotSharingPass : public FunctionPass {
+	static char ID;
+	StackSlotSharingPass() : FunctionPass(ID) {}
+
+	virtual bool runOnFunction(Function& func) override {
+		const DataLayout& dataLayout = func.getParent()->getDataLayout();
+
+		MayPointToInfo bottom;
+		MayPointToAnalysis pointTo(bottom, bottom);
+		pointTo.setCheckpointInterval(DFACheckpointInterval);
+		pointTo.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		pointTo.runWorklistAlgorithm(&func, false);
+
+		// The static allocas, by index
+		std::map<unsigned, AllocaInst*> allocas;
+		for (Instruction& instr : func.getEntryBlock()) {
+			AllocaInst* alloca = dyn_cast<AllocaInst>(&instr);
+			if (alloca && alloca->isStaticAlloca() && alloca->getType()->getAddressSpace() == 0) {
+				allocas[pointTo.getIndex(alloca)] = alloca;
+			}
+		}
+
+		// Drop the allocas whose address goes anywhere but a load, a store or a lifetime marker
+		std::map<Instruction*, std::unordered_set<unsigned>> loadPointees, storePointees;
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			if (isa<GetElementPtrInst>(instr) || isa<BitCastInst>(instr) ||
+				isa<PHINode>(instr) || isa<SelectInst>(instr)) {
+				continue;
+			}
+			IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(instr);
+			if (intrinsic && (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+							  intrinsic->getIntrinsicID() == Intrinsic::lifetime_end)) {
+				continue;
+			}
+			for (Use& operand : instr->operands()) {
+				if (!operand->getType()->isPointerTy()) {
+					continue;
+				}
+				std::unordered_set<unsigned> pointees = pointTo.getPointees(operand.get(), instr);
+				LoadInst* load = dyn_cast<LoadInst>(instr);
+				StoreInst* store = dyn_cast<StoreInst>(instr);
+				if (load) {
+					loadPointees[instr] = std::move(pointees);
+				}
+				else if (store && operand.getOperandNo() == store->getPointerOperandIndex()) {
+					storePointees[instr] = std::move(pointees);
+				}
+				else {
+					for (unsigned pointee : pointees) {
+						allocas.erase(pointee);
+					}
+				}
+			}
+		}
+
+		// alloca index -> bit
+		std::vector<AllocaInst*> slots;
+		std::map<unsigned, unsigned> slotBit;
+		for (auto& alloca : allocas) {
+			slotBit[alloca.first] = slots.size();
+			slots.push_back(alloca.second);
+		}
+		unsigned numMerged = 0, numShared = 0;
+		uint64_t numBytesSaved = 0;
+		if (slots.size() > 1) {
+			mergeSlots(func, dataLayout, pointTo, slots, slotBit, loadPointees, storePointees,
+					   numMerged, numShared, numBytesSaved);
+		}
+
+		errs() << func.getName() << ": merged " << numMerged << " allocas into " << numShared
+			   << " shared slots, saved " << numBytesSaved << " stack bytes\n";
+		return numMerged != 0;
+	}
+
+private:
+	static uint64_t getAllocaSize(AllocaInst* alloca, const DataLayout& dataLayout) {
+		uint64_t size = dataLayout.getTypeAllocSize(alloca->getAllocatedType());
+		if (alloca->isArrayAllocation()) {
+			size *= cast<ConstantInt>(alloca->getArraySize())->getZExtValue();
+		}
+		return size;
+	}
+
+	static unsigned getAllocaAlignment(AllocaInst* alloca, const DataLayout& dataLayout) {
+		unsigned alignment = alloca->getAlignment();
+		return alignment ? alignment : dataLayout.getPrefTypeAlignment(alloca->getAllocatedType());
+	}
+
+	void mergeSlots(Function& func, const DataLayout& dataLayout, MayPointToAnalysis& pointTo,
+					const std::vector<AllocaInst*>& slots, const std::map<unsigned, unsigned>& slotBit,
+					const std::map<Instruction*, std::unordered_set<unsigned>>& loadPointees,
+					const std::map<Instruction*, std::unordered_set<unsigned>>& storePointees,
+					unsigned& numMerged, unsigned& numShared, uint64_t& numBytesSaved) {
+		// The candidates each load and store may access, and the one a store overwrites entirely
+		auto toBits = [&](const std::unordered_set<unsigned>& pointees) {
+			BitVector bits(slots.size());
+			for (unsigned pointee : pointees) {
+				auto slot = slotBit.find(pointee);
+				if (slot != slotBit.end()) {
+					bits.set(slot->second);
+				}
+			}
+			return bits;
+		};
+		std::map<Instruction*, BitVector> loads, stores;
+		std::map<Instruction*, unsigned> kills;
+		for (auto& load : loadPointees) {
+			loads[load.first] = toBits(load.second);
+		}
+		for (auto& store : storePointees) {
+			stores[store.first] = toBits(store.second);
+			StoreInst* storeInstr = cast<StoreInst>(store.first);
+			AllocaInst* target = dyn_cast<AllocaInst>(storeInstr->getPointerOperand()->stripPointerCasts());
+			auto slot = slotBit.find(target ? pointTo.getIndex(target) : 0);
+			if (slot != slotBit.end() &&
+				dataLayout.getTypeStoreSize(storeInstr->getValueOperand()->getType()) >= getAllocaSize(target, dataLayout)) {
+				kills[store.first] = slot->second;
+			}
+		}
+
+		SlotLivenessAnalysis liveness(slots, loads, kills);
+		liveness.setCheckpointInterval(DFACheckpointInterval);
+		liveness.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		liveness.analyze(&func, false);
+		WrittenSlotsAnalysis written(slots, stores);
+		written.setCheckpointInterval(DFACheckpointInterval);
+		written.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		written.analyze(&func, false);
+
+		// A store conflicts with the slots in use after it even if what it writes is never read
+		std::vector<BitVector> conflicts(slots.size(), BitVector(slots.size()));
+		for (inst_iterator it = inst_begin(func), e = inst_end(func); it != e; ++it) {
+			Instruction* instr = &*it;
+			// the phi nodes of a block are one program point
+			if (isa<PHINode>(instr) && instr != &instr->getParent()->front()) {
+				continue;
+			}
+			BitVector active = liveness.getBitsAfter(instr);
+			auto store = stores.find(instr);
+			if (store != stores.end()) {
+				active |= store->second;
+			}
+			active &= written.getBitsAfter(instr);
+			for (int bit = active.find_first(); bit != -1; bit = active.find_next(bit)) {
+				conflicts[bit] |= active;
+			}
+		}
+
+		// Largest first, each into the first shared slot none of whose members it conflicts with
+		std::vector<unsigned> order;
+		for (unsigned i = 0; i < slots.size(); ++i) {
+			order.push_back(i);
+		}
+		std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+			return getAllocaSize(slots[a], dataLayout) > getAllocaSize(slots[b], dataLayout);
+		});
+		std::vector<BitVector> sharedSlots;
+		for (unsigned i : order) {
+			bool placed = false;
+			for (BitVector& members : sharedSlots) {
+				if (!members.anyCommon(conflicts[i])) {
+					members.set(i);
+					placed = true;
+					break;
+				}
+			}
+			if (!placed) {
+				sharedSlots.push_back(BitVector(slots.size()));
+				sharedSlots.back().set(i);
+			}
+		}
+
+		LLVMContext& ctx = func.getContext();
+		Instruction* insertPoint = &*func.getEntryBlock().getFirstInsertionPt();
+		for (BitVector& members : sharedSlots) {
+			if (members.count() < 2) {
+				continue;
+			}
+			uint64_t size = 0, sumSizes = 0;
+			unsigned alignment = 1;
+			for (int bit = members.find_first(); bit != -1; bit = members.find_next(bit)) {
+				uint64_t memberSize = getAllocaSize(slots[bit], dataLayout);
+				size = std::max(size, memberSize);
+				sumSizes += memberSize;
+				alignment = std::max(alignment, getAllocaAlignment(slots[bit], dataLayout));
+			}
+			AllocaInst* shared = new AllocaInst(ArrayType::get(Type::getInt8Ty(ctx), size), 0, nullptr, alignment,
+												"shared.slot", insertPoint);
+			for (int bit = members.find_first(); bit != -1; bit = members.find_next(bit)) {
+				AllocaInst* member = slots[bit];
+				// The markers of one member say nothing about the others
+				std::vector<Instruction*> markers;
+				collectLifetimeMarkers(member, markers);
+				for (Instruction* marker : markers) {
+					marker->eraseFromParent();
+				}
+				Instruction* cast = new BitCastInst(shared, member->getType(), "", member);
+				cast->takeName(member);
+				member->replaceAllUsesWith(cast);
+				member->eraseFromParent();
+				++numMerged;
+			}
+			numBytesSaved += sumSizes - size;
+			++numShared;
+		}
+	}
+
+	// The lifetime markers on value, seen through bitcasts and getelementptrs
+	static void collectLifetimeMarkers(Value* value, std::vector<Instruction*>& markers) {
+		for (User* user : value->users()) {
+			IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(user);
+			if (intrinsic && (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+							  intrinsic->getIntrinsicID() == Intrinsic::lifetime_end)) {
+				markers.push_back(intrinsic);
+			}
+			else if (isa<BitCastInst>(user) || isa<GetElementPtrInst>(user)) {
+				collectLifetimeMarkers(user, markers);
+			}
+		}
+	}
+};
+}
+
+char StackSlotSharingPass::ID = 0;
+static RegisterPass<StackSlotSharingPass> cse231_slot_sharing(
+	"cse231-slot-sharing",
+	"cse231-slot-sharing",
+	false,
+	false);
+
+}
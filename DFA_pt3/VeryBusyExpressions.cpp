@@ -0,0 +1,29 @@
+#include "ExpressionAnalysis.h"
+
+namespace llvm {
+
+namespace {
+
+struct VeryBusyExpressionsPass : public FunctionPass {
+	static char ID;
+	VeryBusyExpressionsPass() : FunctionPass(ID) {}
+
+	virtual bool runOnFunction(Function& func) override {
+		VeryBusyExpressionsAnalysis analysis;
+		analysis.setCheckpointInterval(DFACheckpointInterval);
+		analysis.setMemoryBudget((std::size_t)DFAMemoryBudget << 20);
+		analysis.analyze(&func);
+
+		return false;
+	}
+};
+}
+
+char VeryBusyExpressionsPass::ID = 0;
+static RegisterPass<VeryBusyExpressionsPass> cse231_verybusy(
+	"cse231-verybusy",
+	"cse231-verybusy",
+	false,
+	false);
+
+}
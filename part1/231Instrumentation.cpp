@@ -0,0 +1,387 @@
+#include "231Instrumentation.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+//  on by default: plain adds lose counts as soon as two threads run the same code
+static cl::opt<bool> AtomicCounters(
+	"cse231-atomic-counters",
+	cl::desc("Increment the inline counters with relaxed atomic adds; =false for plain adds in single-threaded programs"),
+	cl::init(true));
+
+cl::opt<unsigned> llvm::SamplePeriod(
+	"cse231-sample-period",
+	cl::desc("Run the instrumented code of a function for one call in N and scale the counts by N"),
+	cl::value_desc("N"),
+	cl::init(0));
+
+cl::opt<std::string> llvm::ProfileFilename(
+	"cse231-profile",
+	cl::desc("Profile written by the cse231_rt runtime, raw or merged by cse231-profdata"),
+	cl::value_desc("filename"));
+
+GlobalVariable* llvm::createCounterArray(Module& module, unsigned numCounters, const Twine& name) {
+	ArrayType* countersTy = ArrayType::get(Type::getInt64Ty(module.getContext()), numCounters);
+	return new GlobalVariable(
+		module,
+		countersTy,
+		false,
+		GlobalValue::InternalLinkage,
+		ConstantAggregateZero::get(countersTy),
+		name);
+}
+
+Instruction* llvm::createDumpFunction(Module& module, const Twine& name) {
+	LLVMContext& ctx = module.getContext();
+	Function* dumpFunc = Function::Create(
+		FunctionType::get(Type::getVoidTy(ctx), false),
+		GlobalValue::InternalLinkage,
+		name,
+		&module);
+	IRBuilder<> dumpBuilder(BasicBlock::Create(ctx, "entry", dumpFunc));
+	Function* writeFunc = cast<Function>(module.getOrInsertFunction(
+		"writeProfile",
+		Type::getVoidTy(ctx)
+	));
+	Instruction* dumpPoint = dumpBuilder.CreateCall(writeFunc, std::vector<Value*>{});
+	dumpBuilder.CreateRetVoid();
+	appendToGlobalDtors(module, dumpFunc, 65535);
+	return dumpPoint;
+}
+
+Instruction* llvm::createInitFunction(Module& module, const Twine& name) {
+	LLVMContext& ctx = module.getContext();
+	Function* initFunc = Function::Create(
+		FunctionType::get(Type::getVoidTy(ctx), false),
+		GlobalValue::InternalLinkage,
+		name,
+		&module);
+	IRBuilder<> initBuilder(BasicBlock::Create(ctx, "entry", initFunc));
+	Instruction* ret = initBuilder.CreateRetVoid();
+	appendToGlobalCtors(module, initFunc, 65535);
+	return ret;
+}
+
+//  <name>.ptr, an i64* global pointing to the internal [numCounters x i64] array <name>
+static GlobalVariable* createCounterPointer(Module& module, unsigned numCounters, const Twine& name) {
+	PointerType* int64PtrTy = Type::getInt64PtrTy(module.getContext());
+	return new GlobalVariable(
+		module,
+		int64PtrTy,
+		false,
+		GlobalValue::InternalLinkage,
+		ConstantExpr::getPointerCast(createCounterArray(module, numCounters, name), int64PtrTy),
+		name + ".ptr");
+}
+
+GlobalVariable* llvm::createRegisteredCounters(Module& module, StringRef registerFunc, const std::vector<Constant*>& names, unsigned countersPerName, const Twine& name) {
+	LLVMContext& ctx = module.getContext();
+	Type* charPtrTy = Type::getInt8PtrTy(ctx);
+
+	if (names.empty()) {
+		return createCounterPointer(module, 0, name);
+	}
+
+	ArrayType* namesTy = ArrayType::get(charPtrTy, names.size());
+	GlobalVariable* namesTable = new GlobalVariable(
+		module,
+		namesTy,
+		true,
+		GlobalValue::InternalLinkage,
+		ConstantArray::get(namesTy, names),
+		name + ".names");
+
+	Function* registerFunction = cast<Function>(module.getOrInsertFunction(
+		registerFunc,
+		Type::getInt64PtrTy(ctx),
+		Type::getInt32Ty(ctx),
+		charPtrTy->getPointerTo()
+	));
+
+	//  counters = registerFunc(#names, names) ?: counters
+	Value* registerArgs[] = {
+		ConstantInt::get(Type::getInt32Ty(ctx), names.size()),
+		ConstantExpr::getPointerCast(namesTable, charPtrTy->getPointerTo())
+	};
+	return createRegisteredCounters(createInitFunction(module, name + ".init"), registerFunction, registerArgs, countersPerName * names.size(), name);
+}
+
+GlobalVariable* llvm::createRegisteredCounters(Instruction* initPoint, Function* registerFunction, ArrayRef<Value*> registerArgs, unsigned numCounters, const Twine& name) {
+	Module& module = *initPoint->getModule();
+	PointerType* int64PtrTy = Type::getInt64PtrTy(module.getContext());
+	GlobalVariable* counters = createCounterPointer(module, numCounters, name);
+	if (!numCounters) {
+		return counters;
+	}
+
+	IRBuilder<> initBuilder(initPoint);
+	Value* profileCounters = initBuilder.CreateCall(registerFunction, registerArgs);
+	Value* isNull = initBuilder.CreateICmpEQ(profileCounters, ConstantPointerNull::get(int64PtrTy));
+	initBuilder.CreateStore(initBuilder.CreateSelect(isNull, counters->getInitializer(), profileCounters), counters);
+	return counters;
+}
+
+std::string llvm::getBlockName(const BasicBlock* bBlock, unsigned blockIndex) {
+	std::string name;
+	raw_string_ostream nameStream(name);
+	nameStream << bBlock->getParent()->getName() << '\t';
+	if (bBlock->hasName()) {
+		nameStream << bBlock->getName();
+	}
+	else {
+		nameStream << "bb" << blockIndex;
+	}
+	return nameStream.str();
+}
+
+std::string llvm::getBranchSiteName(const BranchInst* pBranchInst, unsigned blockIndex) {
+	std::string name;
+	raw_string_ostream nameStream(name);
+	nameStream << getBlockName(pBranchInst->getParent(), blockIndex) << '\t';
+	if (const DILocation* loc = pBranchInst->getDebugLoc()) {
+		nameStream << loc->getFilename() << ':' << loc->getLine() << ':' << loc->getColumn();
+	}
+	else {
+		nameStream << '?';
+	}
+	return nameStream.str();
+}
+
+bool llvm::isInstrumentationFunction(const Function& func) {
+	return func.getName().startswith("cse231.");
+}
+
+void llvm::insertCounterIncrement(Instruction* insertBefore, GlobalVariable* counters, Value* index, Value* executions) {
+	IRBuilder<> counterBuilder(insertBefore);
+	Type* int64Ty = counterBuilder.getInt64Ty();
+
+	Value* counterPtr;
+	if (counters->getValueType()->isPointerTy()) {
+		Value* base = counterBuilder.CreateLoad(counters->getValueType(), counters);
+		counterPtr = counterBuilder.CreateInBoundsGEP(int64Ty, base, index);
+	}
+	else {
+		counterPtr = counterBuilder.CreateInBoundsGEP(
+			counters->getValueType(),
+			counters,
+			std::vector<Value*>{ counterBuilder.getInt32(0), index });
+	}
+	Value* weight = ConstantInt::get(int64Ty, getSampleWeight());
+	if (executions) {
+		weight = getSampleWeight() == 1 ? executions : counterBuilder.CreateMul(executions, weight);
+	}
+	if (AtomicCounters) {
+		counterBuilder.CreateAtomicRMW(AtomicRMWInst::Add, counterPtr, weight, AtomicOrdering::Monotonic);
+		return;
+	}
+	Value* count = counterBuilder.CreateLoad(int64Ty, counterPtr);
+	counterBuilder.CreateStore(counterBuilder.CreateAdd(count, weight), counterPtr);
+}
+
+uint64_t llvm::getSampleWeight() {
+	return SamplePeriod > 1 ? SamplePeriod : 1;
+}
+
+Function* llvm::cloneForSampling(Function& func, ValueToValueMapTy& VMap) {
+	//  never added to the module; the copies keep using the arguments of func
+	Function* uninstrumented = Function::Create(func.getFunctionType(), GlobalValue::InternalLinkage, func.getName());
+	SmallVector<BasicBlock*, 16> blocks;
+	for (BasicBlock& bBlock : func) {
+		BasicBlock* copy = CloneBasicBlock(&bBlock, VMap, ".uninstrumented", uninstrumented);
+		VMap[&bBlock] = copy;
+		blocks.push_back(copy);
+	}
+	remapInstructionsInBlocks(blocks, VMap);
+	return uninstrumented;
+}
+
+namespace {
+	//  fills check with --countdown, going on to unsampled unless the countdown was 1 or
+	//  0, its initial value. The block returned then draws the next countdown with the
+	//  runtime's getSampleCountdown(), around the period at random so that the samples
+	//  don't keep hitting the same phase of a periodic program, and goes on to sampled
+	//  if the countdown was 1. A thread's first countdown is drawn at its first check.
+	BasicBlock* fillSampleCheck(BasicBlock* check, GlobalVariable* countdown, BasicBlock* sampled, BasicBlock* unsampled) {
+		Function* func = check->getParent();
+		Module* pm = func->getParent();
+		LLVMContext& ctx = func->getContext();
+		IntegerType* intTy = Type::getInt32Ty(ctx);
+
+		BasicBlock* reset = BasicBlock::Create(ctx, "cse231.sample.reset", func, check->getNextNode());
+		IRBuilder<> checkBuilder(check);
+		Value* count = checkBuilder.CreateLoad(intTy, countdown);
+		checkBuilder.CreateStore(checkBuilder.CreateSub(count, checkBuilder.getInt32(1)), countdown);
+		checkBuilder.CreateCondBr(
+			checkBuilder.CreateICmpULE(count, checkBuilder.getInt32(1)),
+			reset,
+			unsampled,
+			MDBuilder(ctx).createBranchWeights(1, SamplePeriod - 1));
+
+		Function* nextFunc = cast<Function>(pm->getOrInsertFunction(
+			"getSampleCountdown",
+			intTy,
+			intTy
+		));
+		IRBuilder<> resetBuilder(reset);
+		std::vector<Value*> nextArgs{ resetBuilder.getInt32(SamplePeriod) };
+		resetBuilder.CreateStore(resetBuilder.CreateCall(nextFunc, nextArgs), countdown);
+		resetBuilder.CreateCondBr(resetBuilder.CreateICmpEQ(count, resetBuilder.getInt32(1)), sampled, unsampled);
+		return reset;
+	}
+
+	//  the edges of func into a block that dominates their source, each once
+	std::vector<std::pair<BasicBlock*, BasicBlock*>> getBackEdges(Function& func) {
+		DominatorTree DT(func);
+		std::vector<std::pair<BasicBlock*, BasicBlock*>> backEdges;
+		for (BasicBlock& bBlock : func) {
+			if (!DT.isReachableFromEntry(&bBlock)) {
+				continue;
+			}
+			for (BasicBlock* succ : successors(&bBlock)) {
+				auto edge = std::make_pair(&bBlock, succ);
+				if (DT.dominates(succ, &bBlock) && std::find(backEdges.begin(), backEdges.end(), edge) == backEdges.end()) {
+					backEdges.push_back(edge);
+				}
+			}
+		}
+		return backEdges;
+	}
+}
+
+void llvm::insertSampleDispatch(Function& func, Function* uninstrumented, ValueToValueMapTy& VMap, const Twine& countdownName,
+								bool checkBackEdges) {
+	Module* pm = func.getParent();
+	LLVMContext& ctx = func.getContext();
+	IntegerType* intTy = Type::getInt32Ty(ctx);
+
+	GlobalVariable* countdown = pm->getNamedGlobal(countdownName.str());
+	if (!countdown) {
+		//  thread local: the threads don't fight over its cache line
+		countdown = new GlobalVariable(
+			*pm,
+			intTy,
+			false,
+			GlobalValue::InternalLinkage,
+			ConstantInt::get(intTy, 0),
+			countdownName,
+			nullptr,
+			GlobalVariable::GeneralDynamicTLSModel);
+	}
+
+	//  the instrumented and the uninstrumented copy of each block
+	std::map<BasicBlock*, std::pair<BasicBlock*, BasicBlock*>> blockCopies;
+	for (BasicBlock& bBlock : func) {
+		if (BasicBlock* copy = cast_or_null<BasicBlock>(VMap.lookup(&bBlock))) {
+			blockCopies[&bBlock] = blockCopies[copy] = std::make_pair(&bBlock, copy);
+		}
+	}
+
+	BasicBlock* instrumentedEntry = &func.getEntryBlock();
+	BasicBlock* uninstrumentedEntry = &uninstrumented->getEntryBlock();
+	func.getBasicBlockList().splice(func.end(), uninstrumented->getBasicBlockList());
+	delete uninstrumented;
+
+	//  the entry check picks the copy of the call
+	BasicBlock* dispatch = BasicBlock::Create(ctx, "cse231.sample", &func, instrumentedEntry);
+	fillSampleCheck(dispatch, countdown, instrumentedEntry, uninstrumentedEntry);
+	Instruction* firstCheck = &dispatch->front();
+
+	//  allocas outside the entry block would be dynamic
+	for (auto iter = instrumentedEntry->begin(); iter != instrumentedEntry->end(); ) {
+		AllocaInst* alloca = dyn_cast<AllocaInst>(&*iter++);
+		if (alloca && isa<Constant>(alloca->getArraySize())) {
+			//  the instrumentation's own allocas have no copy
+			if (Value* copy = VMap.lookup(alloca)) {
+				copy->replaceAllUsesWith(alloca);
+				cast<Instruction>(copy)->eraseFromParent();
+			}
+			alloca->moveBefore(firstCheck);
+		}
+	}
+
+	if (!checkBackEdges) {
+		return;
+	}
+
+	//  every back edge of either copy goes through a check as well, which picks the copy
+	//  of the next iteration. Phis of the headers take the value of the back edge either way
+	std::vector<std::pair<BasicBlock*, BasicBlock*>> backEdges = getBackEdges(func);
+	for (auto& backEdge : backEdges) {
+		BasicBlock* latch = backEdge.first;
+		BasicBlock* header = backEdge.second;
+		auto copies = blockCopies.find(header);
+		if (copies == blockCopies.end()) {
+			continue;
+		}
+		BasicBlock* sampled = copies->second.first;
+		BasicBlock* unsampled = copies->second.second;
+
+		std::vector<Value*> incoming;
+		for (PHINode& phi : header->phis()) {
+			incoming.push_back(phi.getIncomingValueForBlock(latch));
+			while (phi.getBasicBlockIndex(latch) != -1) {
+				phi.removeIncomingValue(latch, false);
+			}
+		}
+		BasicBlock* check = BasicBlock::Create(ctx, "cse231.sample.loop", &func, latch->getNextNode());
+		TerminatorInst* terminator = latch->getTerminator();
+		for (unsigned s = 0; s < terminator->getNumSuccessors(); ++s) {
+			if (terminator->getSuccessor(s) == header) {
+				terminator->setSuccessor(s, check);
+			}
+		}
+		BasicBlock* reset = fillSampleCheck(check, countdown, sampled, unsampled);
+
+		unsigned i = 0;
+		for (PHINode& phi : sampled->phis()) {
+			phi.addIncoming(incoming[i++], reset);
+		}
+		i = 0;
+		for (PHINode& phi : unsampled->phis()) {
+			phi.addIncoming(incoming[i], check);
+			phi.addIncoming(incoming[i++], reset);
+		}
+	}
+	if (backEdges.empty()) {
+		return;
+	}
+
+	//  past a check, a value may come from either copy
+	DominatorTree DT(func);
+	SSAUpdater updater;
+	for (BasicBlock& bBlock : func) {
+		auto copies = blockCopies.find(&bBlock);
+		if (copies == blockCopies.end() || copies->second.first != &bBlock) {
+			continue;
+		}
+		for (Instruction& instr : bBlock) {
+			Instruction* copy = cast_or_null<Instruction>(VMap.lookup(&instr));
+			if (!copy || copy == &instr || instr.getType()->isVoidTy()) {
+				continue;
+			}
+			updater.Initialize(instr.getType(), instr.getName());
+			updater.AddAvailableValue(instr.getParent(), &instr);
+			updater.AddAvailableValue(copy->getParent(), copy);
+			for (Instruction* def : { &instr, copy }) {
+				for (auto useIter = def->use_begin(); useIter != def->use_end(); ) {
+					Use& use = *useIter++;
+					if (!DT.dominates(def, use)) {
+						updater.RewriteUse(use);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,127 @@
+//===- 231Instrumentation.h - Helpers for the CSE 231 part 1 passes ------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file provides the counter and exit dump plumbing shared by the
+// instrumentation passes of part 1
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231INSTRUMENTATION_H
+#define LLVM_TRANSFORMS_231INSTRUMENTATION_H
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+/*
+ * A zero initialized internal [numCounters x i64] array.
+ */
+GlobalVariable* createCounterArray(Module& module, unsigned numCounters, const Twine& name);
+
+/*
+ * An internal void() function registered in llvm.global_dtors that calls the
+ * runtime's writeProfile() once when the program exits. Returns that call;
+ * the code handing the module's counters to the runtime goes before it.
+ */
+Instruction* createDumpFunction(Module& module, const Twine& name);
+
+/*
+ * -cse231-profile, the profile read by the profile-guided passes.
+ */
+extern cl::opt<std::string> ProfileFilename;
+
+/*
+ * An internal void() function registered in llvm.global_ctors. Returns its
+ * ret; the initialization code goes before it.
+ */
+Instruction* createInitFunction(Module& module, const Twine& name);
+
+/*
+ * An i64* global <name>.ptr to the module's countersPerName * names.size()
+ * counters. The module constructor points it at the counters the runtime's
+ * registerFunc(#names, names) allocates in the profile, or at the internal
+ * array <name> if that returns null. names are i8* constants.
+ */
+GlobalVariable* createRegisteredCounters(Module& module, StringRef registerFunc, const std::vector<Constant*>& names, unsigned countersPerName, const Twine& name);
+
+/*
+ * An i64* global <name>.ptr to numCounters counters, pointed before initPoint,
+ * in a module constructor, at those registerFunction(registerArgs) returns, or
+ * at the internal array <name> if that returns null.
+ */
+GlobalVariable* createRegisteredCounters(Instruction* initPoint, Function* registerFunction, ArrayRef<Value*> registerArgs, unsigned numCounters, const Twine& name);
+
+/*
+ * "function\tblock", the name of a block in the profile. Unnamed blocks are
+ * bb<blockIndex>, the position in the function.
+ */
+std::string getBlockName(const BasicBlock* bBlock, unsigned blockIndex);
+
+/*
+ * "function\tblock\tfile:line:column", the name of a cse231-bb branch site in
+ * the profile. The location is '?' without debug info.
+ */
+std::string getBranchSiteName(const BranchInst* pBranchInst, unsigned blockIndex);
+
+/*
+ * Functions and globals the passes add are named cse231.*; they aren't instrumented.
+ */
+bool isInstrumentationFunction(const Function& func);
+
+/*
+ * counters[index] += executions * getSampleWeight() before insertBefore.
+ * index is an i32 and executions an i64, 1 if null. counters is either the
+ * i64 array or an i64* global pointing to the counters. The add is a
+ * relaxed atomic unless -cse231-atomic-counters=false.
+ */
+void insertCounterIncrement(Instruction* insertBefore, GlobalVariable* counters, Value* index, Value* executions = nullptr);
+
+/*
+ * -cse231-sample-period=N: an instrumented function runs its instrumented
+ * code for one call in N of each thread, on average, and an uninstrumented
+ * copy for the others; see insertSampleDispatch. Each sampled execution
+ * counts N times.
+ */
+extern cl::opt<unsigned> SamplePeriod;
+
+/*
+ * What one counted execution adds: the sample period, or 1 without sampling.
+ */
+uint64_t getSampleWeight();
+
+/*
+ * The blocks of func cloned into a detached function, to be called before
+ * func is instrumented. VMap maps the original values to their copies.
+ */
+Function* cloneForSampling(Function& func, ValueToValueMapTy& VMap);
+
+/*
+ * Moves the blocks of uninstrumented, cloned by cloneForSampling, back into
+ * the instrumented func behind a new entry block that counts down the
+ * module's thread local countdown and enters the instrumented code when it
+ * expires, drawing the next one with the runtime's getSampleCountdown(). Static
+ * allocas move into the new entry and are shared.
+ *
+ * With checkBackEdges, the back edges of both copies count down as well and
+ * pick the copy of the next iteration (Arnold and Ryder), so that a call that
+ * loops for long is sampled too. A sample then starts at a loop header and
+ * ends at the next back edge: only instrumentation that counts each block or
+ * branch on its own, with no values live across blocks, may use it.
+ */
+void insertSampleDispatch(Function& func, Function* uninstrumented, ValueToValueMapTy& VMap, const Twine& countdownName,
+						  bool checkBackEdges = false);
+
+}
+#endif
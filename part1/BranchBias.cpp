@@ -1,6 +1,8 @@
+#include "231Instrumentation.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/GlobalVariable.h"
@@ -12,48 +14,135 @@
 
 using namespace llvm;
 
+static cl::opt<bool> SiteCounters(
+	"bb-site-counters",
+	cl::desc("Count every conditional branch separately with inline counters and report the sites at exit"),
+	cl::init(false));
+
 namespace {
 	struct BranchBias : public FunctionPass {
 		static char ID;
 		BranchBias() : FunctionPass(ID) {}
 
+		virtual bool doInitialization(Module& module) override;
 		virtual bool runOnFunction(Function& func) override;
+
+	private:
+		//  -bb-site-counters: an i64* to [taken, not taken] for every conditional branch of
+		//  the module. it starts out at a module array and is pointed into the runtime's
+		//  profile by the module constructor.
+		GlobalVariable* Counters = nullptr;
+		std::map<BranchInst*, unsigned> SiteIndex;
 	};
 }
 
+bool BranchBias::doInitialization(Module& module) {
+	Counters = nullptr;
+	SiteIndex.clear();
+
+	//  the profile is written once, when the program exits. the dump code is
+	//  built here: changes made by doFinalization come too late for opt's output
+	createDumpFunction(module, "cse231.bb.dump");
+	if (!SiteCounters) {
+		return true;
+	}
+
+	std::vector<Constant*> siteNames;
+	for (Function& func : module) {
+		if (isInstrumentationFunction(func)) {
+			continue;
+		}
+		unsigned blockIndex = 0;
+		for (BasicBlock& bBlock : func) {
+			BranchInst* pBranchInst = dyn_cast<BranchInst>(bBlock.getTerminator());
+			if (pBranchInst && pBranchInst->isConditional()) {
+				SiteIndex[pBranchInst] = siteNames.size();
+				IRBuilder<> nameBuilder(pBranchInst);
+				siteNames.push_back(cast<Constant>(nameBuilder.CreateGlobalStringPtr(getBranchSiteName(pBranchInst, blockIndex))));
+			}
+			++blockIndex;
+		}
+	}
+	Counters = createRegisteredCounters(module, "registerBranchSites", siteNames, 2, "cse231.bb.counters");
+	return true;
+}
+
 bool BranchBias::runOnFunction(Function& func) {
 	LLVMContext& ctx = func.getContext();
 	Module* pm = func.getParent();
 
-	for (BasicBlock& bBlock : func) {
-		for (Instruction& inst : bBlock) {
-			if (BranchInst* pBranchInst = dyn_cast<BranchInst>(&inst)) {
-				if (pBranchInst->isConditional()) {
-					//  prepare function call arguments
-					IRBuilder<> updateFuncBuilder(bBlock.getTerminator());
+	if (isInstrumentationFunction(func)) {
+		return false;
+	}
 
-					Function* updateFunc = cast<Function>(pm->getOrInsertFunction(
-						"updateBranchInfo",
-						Type::getVoidTy(ctx),
-						Type::getInt1Ty(ctx)
-					));
+	ValueToValueMapTy VMap;
+	Function* uninstrumented = SamplePeriod > 1 ? cloneForSampling(func, VMap) : nullptr;
+	bool changed = false;
+	if (Counters) {
+		for (BasicBlock& bBlock : func) {
+			//  sites added after doInitialization have no counters
+			auto siteIter = SiteIndex.find(dyn_cast<BranchInst>(bBlock.getTerminator()));
+			if (siteIter == SiteIndex.end()) {
+				continue;
+			}
+			//  counters[2 * site + (cond ? 0 : 1)] += 1, with no call and no extra branch
+			BranchInst* pBranchInst = siteIter->first;
+			IRBuilder<> counterBuilder(pBranchInst);
+			Value* index = counterBuilder.CreateSelect(
+				pBranchInst->getCondition(),
+				counterBuilder.getInt32(2 * siteIter->second),
+				counterBuilder.getInt32(2 * siteIter->second + 1));
+			insertCounterIncrement(pBranchInst, Counters, index);
+			changed = true;
+		}
+	}
+	else {
+		for (BasicBlock& bBlock : func) {
+			//  the sampling checks of cse231-cdi aren't the program's branches
+			if (bBlock.getName().startswith("cse231.")) {
+				continue;
+			}
+			for (Instruction& inst : bBlock) {
+				if (BranchInst* pBranchInst = dyn_cast<BranchInst>(&inst)) {
+					if (pBranchInst->isConditional()) {
+						//  prepare function call arguments
+						IRBuilder<> updateFuncBuilder(bBlock.getTerminator());
 
-					std::vector<Value*> updateFuncArgs{ pBranchInst->getCondition() };
+						if (uninstrumented) {
+							//  a sampled execution stands for getSampleWeight() of them
+							Function* updateFunc = cast<Function>(pm->getOrInsertFunction(
+								"updateSampledBranchInfo",
+								Type::getVoidTy(ctx),
+								Type::getInt1Ty(ctx),
+								Type::getInt32Ty(ctx)
+							));
+							std::vector<Value*> updateFuncArgs{ pBranchInst->getCondition(), updateFuncBuilder.getInt32(getSampleWeight()) };
+							updateFuncBuilder.CreateCall(updateFunc, updateFuncArgs);
+							continue;
+						}
 
-					//  call function
-					updateFuncBuilder.CreateCall(updateFunc, updateFuncArgs);
+						Function* updateFunc = cast<Function>(pm->getOrInsertFunction(
+							"updateBranchInfo",
+							Type::getVoidTy(ctx),
+							Type::getInt1Ty(ctx)
+						));
+
+						std::vector<Value*> updateFuncArgs{ pBranchInst->getCondition() };
+
+						//  call function
+						updateFuncBuilder.CreateCall(updateFunc, updateFuncArgs);
+					}
 				}
 			}
 		}
+		changed = true;
+	}
+
+	if (uninstrumented) {
+		insertSampleDispatch(func, uninstrumented, VMap, "cse231.bb.countdown", true);
 	}
-	IRBuilder<> printFuncBuilder(func.back().getTerminator());
-	Function* printFunc = cast<Function>(pm->getOrInsertFunction(
-		"printOutBranchInfo",
-		Type::getVoidTy(ctx)
-	));
-	printFuncBuilder.CreateCall(printFunc, std::vector<Value*>{});
 	//  return true if the original function is modified
-	return true;
+	return changed;
 }
 
 //  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
@@ -0,0 +1,136 @@
+#include "231Instrumentation.h"
+#include "../runtime/231Profile.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+/*
+ * Attaches branch_weights to the conditional branches of a profile written
+ * by cse231-bb -bb-site-counters. Sites are matched by name, so a branch
+ * whose function, block or source location moved since the profile was
+ * taken gets no weights; such branches and the profile sites left over in
+ * the same functions are reported as stale.
+ */
+namespace {
+	struct BranchWeights : public FunctionPass {
+		static char ID;
+		BranchWeights() : FunctionPass(ID) {}
+
+		virtual bool doInitialization(Module& module) override;
+		virtual bool runOnFunction(Function& func) override;
+		virtual bool doFinalization(Module& module) override;
+
+	private:
+		//  site name -> taken, total
+		StringMap<std::pair<uint64_t, uint64_t>> Sites;
+		//  the functions that have sites in the profile
+		StringSet<> ProfiledFunctions;
+		StringSet<> MatchedSites;
+		unsigned NumBranches = 0;
+		unsigned NumAnnotated = 0;
+	};
+}
+
+bool BranchWeights::doInitialization(Module& module) {
+	Sites.clear();
+	ProfiledFunctions.clear();
+	MatchedSites.clear();
+	NumBranches = NumAnnotated = 0;
+
+	if (ProfileFilename.empty()) {
+		errs() << "cse231-branch-weights: no -cse231-profile given\n";
+		return false;
+	}
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(ProfileFilename);
+	if (!buffer) {
+		errs() << "cse231-branch-weights: " << ProfileFilename << ": " << buffer.getError().message() << '\n';
+		return false;
+	}
+
+	auto visit = [this](const cse231::RecordHeader& record, std::vector<std::string>& names, std::vector<uint64_t>& counters) {
+		if (record.Kind != cse231::SiteRecord) {
+			return;
+		}
+		for (unsigned i = 0; i < names.size(); ++i) {
+			std::pair<uint64_t, uint64_t>& counts = Sites[names[i]];
+			counts.first += counters[2 * i];
+			counts.second += counters[2 * i] + counters[2 * i + 1];
+			ProfiledFunctions.insert(StringRef(names[i]).split('\t').first);
+		}
+	};
+	std::string error;
+	StringRef data = (*buffer)->getBuffer();
+	if (!cse231::forEachRecord(data.data(), data.size(), visit, error)) {
+		errs() << "cse231-branch-weights: " << ProfileFilename << ": " << error << '\n';
+		Sites.clear();
+		ProfiledFunctions.clear();
+	}
+	return false;
+}
+
+bool BranchWeights::runOnFunction(Function& func) {
+	if (!ProfiledFunctions.count(func.getName())) {
+		return false;
+	}
+
+	MDBuilder weightsBuilder(func.getContext());
+	bool changed = false;
+	unsigned blockIndex = 0;
+	for (BasicBlock& bBlock : func) {
+		BranchInst* pBranchInst = dyn_cast<BranchInst>(bBlock.getTerminator());
+		if (pBranchInst && pBranchInst->isConditional()) {
+			++NumBranches;
+			std::string name = getBranchSiteName(pBranchInst, blockIndex);
+			auto siteIter = Sites.find(name);
+			if (siteIter == Sites.end()) {
+				errs() << "stale: branch without profile\t" << name << '\n';
+			}
+			else {
+				MatchedSites.insert(name);
+				uint64_t taken = siteIter->second.first;
+				uint64_t notTaken = siteIter->second.second - taken;
+				//  never executed: nothing to go by
+				if (taken + notTaken != 0) {
+					//  branch_weights are 32 bit
+					uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+					pBranchInst->setMetadata(LLVMContext::MD_prof, weightsBuilder.createBranchWeights(taken / scale, notTaken / scale));
+					++NumAnnotated;
+					changed = true;
+				}
+			}
+		}
+		++blockIndex;
+	}
+	return changed;
+}
+
+//  the profile sites of the module's functions that matched no branch
+bool BranchWeights::doFinalization(Module& module) {
+	unsigned numStale = 0;
+	for (auto& site : Sites) {
+		if (!MatchedSites.count(site.getKey()) && module.getFunction(site.getKey().split('\t').first)) {
+			errs() << "stale: profile without branch\t" << site.getKey() << '\n';
+			++numStale;
+		}
+	}
+	errs() << "cse231-branch-weights: annotated " << NumAnnotated << " of " << NumBranches
+		<< " profiled branches, " << numStale << " stale profile sites\n";
+	return false;
+}
+
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
+char BranchWeights::ID = 0;
+static RegisterPass<BranchWeights> cse231_branch_weights(
+	"cse231-branch-weights",
+	"cse231-branch-weights",
+	false,
+	false);
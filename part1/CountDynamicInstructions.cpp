@@ -1,31 +1,604 @@
+#include "231Instrumentation.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/ADT/APInt.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
 #include <map>
 #include <vector>
 #include <cstring>
 
 using namespace llvm;
 
+static cl::opt<bool> InlineCounters(
+	"cdi-inline-counters",
+	cl::desc("Count basic block executions with inline counters and derive the opcode counts at exit"),
+	cl::init(false));
+
+static cl::opt<bool> EdgeCounters(
+	"cdi-edge-counters",
+	cl::desc("Count only the CFG edges off a maximum spanning tree and reconstruct the block counts at exit"),
+	cl::init(false));
+
 namespace {
+	//  a CFG edge for -cdi-edge-counters. the virtual exit node has index func.size().
+	struct CFGEdge {
+		CFGEdge(unsigned src, unsigned dst, unsigned succIndex, uint64_t weight, bool fixed) :
+			Src(src), Dst(dst), SuccIndex(succIndex), Weight(weight), Fixed(fixed) {}
+
+		unsigned Src, Dst;
+		//  successor index in the terminator of Src
+		unsigned SuccIndex;
+		//  expected frequency; heavy edges go into the tree and stay uninstrumented
+		uint64_t Weight;
+		//  the edge can't carry a counter and has to be a tree edge
+		bool Fixed;
+		bool InTree = false;
+		//  the edge count as a linear combination of the counters: counter -> coefficient
+		bool Known = false;
+		std::map<unsigned, int64_t> Count;
+	};
+
+	//  -cdi-inline-counters: a loop whose blocks' counters are added once at its exit
+	struct CountedLoop {
+		Loop* L;
+		//  the only block leaving the loop; it runs on every iteration
+		BasicBlock* Exiting;
+		const SCEV* BackedgeTakenCount;
+		//  the blocks running once per iteration: those up to Exiting run
+		//  BackedgeTakenCount + 1 times per entry, those after it BackedgeTakenCount times
+		std::vector<std::pair<BasicBlock*, bool>> Blocks;
+	};
+
+	//  a constant array with the contents of histogram, one per distinct contents in arrays
+	template <typename T>
+	GlobalVariable* getSharedArray(Module& module, const std::vector<T>& histogram, std::map<std::vector<T>, GlobalVariable*>& arrays) {
+		GlobalVariable*& array = arrays[histogram];
+		if (!array) {
+			array = new GlobalVariable(
+				module,
+				ArrayType::get(Type::getIntNTy(module.getContext(), 8 * sizeof(T)), histogram.size()),
+				true,
+				GlobalValue::InternalLinkage,
+				ConstantDataArray::get(module.getContext(), histogram),
+				"cse231.cdi.histogram");
+			array->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+		}
+		return array;
+	}
+
+	//  a call that may leave the program (exit, longjmp) with its caller's block
+	//  half done: anything but intrinsics and calls that only read memory
+	bool mayNotReturn(const Instruction& inst) {
+		ImmutableCallSite call(&inst);
+		return call && !isa<IntrinsicInst>(inst) && !call.onlyReadsMemory();
+	}
+
+	bool hasCallThatMayNotReturn(const BasicBlock& bBlock) {
+		return std::any_of(bBlock.begin(), bBlock.end(), [](const Instruction& inst) {
+			return mayNotReturn(inst);
+		});
+	}
+
+	//  the length n of the opcode histogram of bBlock followed by its n (opcode, count) pairs
+	std::vector<uint32_t> getOpcodeHistogram(BasicBlock& bBlock) {
+		std::map<uint32_t, uint32_t> instCount;
+		for (Instruction& inst : bBlock) {
+			++instCount[inst.getOpcode()];
+		}
+		std::vector<uint32_t> histogram{ (uint32_t)instCount.size() };
+		for (auto& item : instCount) {
+			histogram.push_back(item.first);
+			histogram.push_back(item.second);
+		}
+		return histogram;
+	}
+
 	struct CountDynamicInstructions : public FunctionPass {
 		static char ID;
 		CountDynamicInstructions() : FunctionPass(ID) {}
 
+		virtual bool doInitialization(Module& module) override;
 		virtual bool runOnFunction(Function& func) override;
+		virtual bool doFinalization(Module& module) override;
+		virtual void getAnalysisUsage(AnalysisUsage& AU) const override;
+
+	private:
+		bool instrumentEdges(Function& func);
+		void instrumentBlocks(Function& func);
+		std::vector<CountedLoop> findCountedLoops(Function& func);
+		void insertLoopCounterIncrements(const CountedLoop& loop, const std::map<BasicBlock*, unsigned>& blockCounters);
+		Value* insertCounterLoad(GlobalVariable* counters, unsigned counter);
+		uint32_t getHistogramOffset(BasicBlock& bBlock);
+		bool hasBlockCounters(Function& func);
+		GlobalVariable* createTableArray(Module& module, const std::vector<uint32_t>& table, const char* name);
+		GlobalVariable* getHistogramArray(Module& module, const std::vector<uint32_t>& histogram);
+		GlobalVariable* getHistogramArray(Module& module, const std::vector<uint64_t>& histogram);
+
+		//  -cdi-inline-counters: an i64* global to one counter per basic block of the module
+		GlobalVariable* Counters = nullptr;
+		//  first counter and number of counters reserved for each function
+		std::map<Function*, std::pair<unsigned, unsigned>> FunctionCounters;
+		//  module destructor that hands the counts to the runtime and writes the profile
+		Function* DumpFunc = nullptr;
+		//  the dump code goes before it: the writeProfile call in DumpFunc, or
+		//  the addBlockHistograms call before it with inline or edge counters
+		Instruction* DumpPoint = nullptr;
+		//  for each counter in Counters, the offset of its block's opcode histogram (see
+		//  getOpcodeHistogram) in HistogramTable, where each distinct one is stored once
+		std::vector<uint32_t> BlockHistograms;
+		std::vector<uint32_t> HistogramTable;
+		std::map<std::vector<uint32_t>, uint32_t> HistogramOffsets;
+		//  the opcode (i32) and count (i64) arrays of the blocks' histograms, one per distinct contents
+		std::map<std::vector<uint32_t>, GlobalVariable*> HistogramArrays;
+		std::map<std::vector<uint64_t>, GlobalVariable*> CountArrays;
+		//  block counters in total and those hoisted out of counted loops
+		unsigned NumBlockCounters = 0;
+		unsigned NumHoistedCounters = 0;
+		unsigned NumCountedLoops = 0;
 	};
 }
 
+bool CountDynamicInstructions::doInitialization(Module& module) {
+	Counters = nullptr;
+	FunctionCounters.clear();
+	HistogramArrays.clear();
+	CountArrays.clear();
+	BlockHistograms.clear();
+	HistogramTable.clear();
+	HistogramOffsets.clear();
+	NumBlockCounters = NumHoistedCounters = NumCountedLoops = 0;
+	LLVMContext& ctx = module.getContext();
+
+	//  the profile is written once, when the program exits
+	DumpPoint = createDumpFunction(module, "cse231.cdi.dump");
+	DumpFunc = DumpPoint->getFunction();
+	if (!InlineCounters && !EdgeCounters) {
+		return true;
+	}
+
+	//  -cdi-edge-counters falls back to these for functions it can't handle, and
+	//  stores the block counts it derives in them for the profile
+	unsigned numCounters = 0;
+	std::vector<Constant*> blockNames;
+	IRBuilder<> dumpBuilder(DumpPoint);
+	for (Function& func : module) {
+		if (!func.isDeclaration() && !isInstrumentationFunction(func)) {
+			FunctionCounters[&func] = std::make_pair(numCounters, (unsigned)func.size());
+			numCounters += func.size();
+			unsigned blockIndex = 0;
+			for (BasicBlock& bBlock : func) {
+				blockNames.push_back(cast<Constant>(dumpBuilder.CreateGlobalStringPtr(getBlockName(&bBlock, blockIndex++))));
+				BlockHistograms.push_back(getHistogramOffset(bBlock));
+			}
+		}
+	}
+
+	//  the block counts live in the profile from the start, registered by the module constructor
+	Counters = createRegisteredCounters(module, "registerBlocks", blockNames, 1, "cse231.cdi.counters");
+
+	//  addBlockHistograms(#blocks, counters, index, histograms) after all the dump
+	//  code: a single runtime loop scales every block's opcode histogram by its
+	//  count, with one index entry per block and each distinct histogram stored once
+	Function* addHistogramsFunc = cast<Function>(module.getOrInsertFunction(
+		"addBlockHistograms",
+		Type::getVoidTy(ctx),
+		Type::getInt32Ty(ctx),
+		Type::getInt64PtrTy(ctx),
+		Type::getInt32PtrTy(ctx),
+		Type::getInt32PtrTy(ctx)
+	));
+	std::vector<Value*> addHistogramsArgs{
+		dumpBuilder.getInt32(numCounters),
+		dumpBuilder.CreateLoad(Counters->getValueType(), Counters),
+		dumpBuilder.CreatePointerCast(createTableArray(module, BlockHistograms, "cse231.cdi.histogram.index"), Type::getInt32PtrTy(ctx)),
+		dumpBuilder.CreatePointerCast(createTableArray(module, HistogramTable, "cse231.cdi.histograms"), Type::getInt32PtrTy(ctx))
+	};
+	DumpPoint = dumpBuilder.CreateCall(addHistogramsFunc, addHistogramsArgs);
+
+	return true;
+}
+
+bool CountDynamicInstructions::doFinalization(Module& module) {
+	if (InlineCounters || EdgeCounters) {
+		errs() << "cse231-cdi: hoisted " << NumHoistedCounters << " of " << NumBlockCounters
+			<< " block counters out of " << NumCountedLoops << " counted loops\n";
+	}
+	return false;
+}
+
+void CountDynamicInstructions::getAnalysisUsage(AnalysisUsage& AU) const {
+	if (EdgeCounters) {
+		AU.addRequired<BlockFrequencyInfoWrapperPass>();
+	}
+	if (InlineCounters || EdgeCounters) {
+		AU.addRequired<DominatorTreeWrapperPass>();
+		AU.addRequired<LoopInfoWrapperPass>();
+		AU.addRequired<ScalarEvolutionWrapperPass>();
+	}
+}
+
+/*
+ * The loops with a computable trip count whose counters can be hoisted: a
+ * preheader, one latch, and one exiting block that runs on every iteration
+ * and leaves through a branch. Only the blocks of the loop itself that run
+ * on every iteration are hoisted; inner loops are counted loops of their own.
+ * A loop making a call that may not return is left alone: the program could
+ * exit before the hoisted counts are added.
+ */
+std::vector<CountedLoop> CountDynamicInstructions::findCountedLoops(Function& func) {
+	DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+	ScalarEvolution& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+	std::vector<CountedLoop> countedLoops;
+	for (Loop* L : LI.getLoopsInPreorder()) {
+		BasicBlock* latch = L->getLoopLatch();
+		BasicBlock* exiting = L->getExitingBlock();
+		if (!L->getLoopPreheader() || !latch || !exiting || !L->getExitBlock()
+			|| !isa<BranchInst>(exiting->getTerminator()) || LI.getLoopFor(exiting) != L
+			|| !DT.dominates(exiting, latch)) {
+			continue;
+		}
+		const SCEV* backedgeTakenCount = SE.getExitCount(L, exiting);
+		if (isa<SCEVCouldNotCompute>(backedgeTakenCount) || !isSafeToExpand(backedgeTakenCount, SE)
+			|| std::any_of(L->block_begin(), L->block_end(), [](BasicBlock* bBlock) { return hasCallThatMayNotReturn(*bBlock); })) {
+			continue;
+		}
+
+		CountedLoop countedLoop{ L, exiting, backedgeTakenCount, {} };
+		for (BasicBlock* bBlock : L->blocks()) {
+			if (LI.getLoopFor(bBlock) != L) {
+				continue;
+			}
+			if (DT.dominates(bBlock, exiting)) {
+				countedLoop.Blocks.push_back(std::make_pair(bBlock, true));
+			}
+			else if (DT.dominates(bBlock, latch)) {
+				countedLoop.Blocks.push_back(std::make_pair(bBlock, false));
+			}
+		}
+		countedLoops.push_back(countedLoop);
+	}
+	return countedLoops;
+}
+
+//  counters[block] += trip count at the exit of loop, with the trip count computed in the preheader
+void CountDynamicInstructions::insertLoopCounterIncrements(const CountedLoop& loop, const std::map<BasicBlock*, unsigned>& blockCounters) {
+	DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+	ScalarEvolution& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+	BasicBlock* preheader = loop.L->getLoopPreheader();
+	BasicBlock* exit = loop.L->getExitBlock();
+
+	SCEVExpander expander(SE, preheader->getModule()->getDataLayout(), "cse231.trip");
+	IRBuilder<> tripBuilder(preheader->getTerminator());
+	Value* backedgesTaken = tripBuilder.CreateZExtOrTrunc(
+		expander.expandCodeFor(loop.BackedgeTakenCount, loop.BackedgeTakenCount->getType(), preheader->getTerminator()),
+		tripBuilder.getInt64Ty());
+	Value* iterations = tripBuilder.CreateAdd(backedgesTaken, tripBuilder.getInt64(1));
+
+	//  the loop only leaves through this edge
+	if (exit->getSinglePredecessor() != loop.Exiting) {
+		exit = SplitEdge(loop.Exiting, exit, &DT, &LI);
+	}
+	Instruction* insertBefore = &*exit->getFirstInsertionPt();
+	for (auto& block : loop.Blocks) {
+		insertCounterIncrement(insertBefore, Counters, ConstantInt::get(Type::getInt32Ty(exit->getContext()), blockCounters.at(block.first)),
+			block.second ? iterations : backedgesTaken);
+	}
+}
+
+//  a constant i32 array with the contents of histogram, shared by all the blocks that need it
+GlobalVariable* CountDynamicInstructions::getHistogramArray(Module& module, const std::vector<uint32_t>& histogram) {
+	return getSharedArray(module, histogram, HistogramArrays);
+}
+
+//  a constant i64 array with the contents of histogram, shared by all the blocks that need it
+GlobalVariable* CountDynamicInstructions::getHistogramArray(Module& module, const std::vector<uint64_t>& histogram) {
+	return getSharedArray(module, histogram, CountArrays);
+}
+
+//  load counters[counter] in DumpFunc. the value dominates all the dump code inserted later.
+Value* CountDynamicInstructions::insertCounterLoad(GlobalVariable* counters, unsigned counter) {
+	IRBuilder<> dumpBuilder(DumpPoint);
+	Value* counterPtr = dumpBuilder.CreateConstInBoundsGEP2_32(counters->getValueType(), counters, 0, counter);
+	return dumpBuilder.CreateLoad(dumpBuilder.getInt64Ty(), counterPtr);
+}
+
+//  the offset in HistogramTable of the opcode histogram of bBlock, added if it's new
+uint32_t CountDynamicInstructions::getHistogramOffset(BasicBlock& bBlock) {
+	std::vector<uint32_t> histogram = getOpcodeHistogram(bBlock);
+	auto offset = HistogramOffsets.insert(std::make_pair(histogram, (uint32_t)HistogramTable.size()));
+	if (offset.second) {
+		HistogramTable.insert(HistogramTable.end(), histogram.begin(), histogram.end());
+	}
+	return offset.first->second;
+}
+
+//  whether func's blocks still match their slots in Counters and their histograms in
+//  BlockHistograms. functions changed since doInitialization fall back to calls.
+bool CountDynamicInstructions::hasBlockCounters(Function& func) {
+	auto counterIter = FunctionCounters.find(&func);
+	if (!Counters || counterIter == FunctionCounters.end() || counterIter->second.second != func.size()) {
+		return false;
+	}
+	unsigned counter = counterIter->second.first;
+	for (BasicBlock& bBlock : func) {
+		auto offset = HistogramOffsets.find(getOpcodeHistogram(bBlock));
+		if (offset == HistogramOffsets.end() || offset->second != BlockHistograms[counter++]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//  a constant i32 array with the contents of table
+GlobalVariable* CountDynamicInstructions::createTableArray(Module& module, const std::vector<uint32_t>& table, const char* name) {
+	return new GlobalVariable(
+		module,
+		ArrayType::get(Type::getInt32Ty(module.getContext()), table.size()),
+		true,
+		GlobalValue::InternalLinkage,
+		ConstantDataArray::get(module.getContext(), table),
+		name);
+}
+
+/*
+ * Knuth's optimal counter placement.
+ * The CFG gets a virtual exit node with an edge from every block without
+ * successors and an edge back to the entry. Like gcov, every other block
+ * making a call that may not return gets a fake edge to the exit: the one
+ * taken when the program exits within the call, leaving this frame in a
+ * block it never leaves. A maximum spanning tree over the expected edge
+ * frequencies, with the virtual and fake edges forced in, is left
+ * uninstrumented; only the remaining edges get a counter. Flow conservation
+ * then gives every tree edge, and so every block count, as a linear
+ * combination of the counters, which DumpFunc evaluates at exit and stores in
+ * the function's slots in Counters.
+ * Returns false, without touching the function, if it has no slots in
+ * Counters (see hasBlockCounters), if some edge that can't carry a counter
+ * (into an EH pad, out of an indirectbr) doesn't fit into the tree, or if
+ * counting the blocks directly is cheaper.
+ */
+bool CountDynamicInstructions::instrumentEdges(Function& func) {
+	LLVMContext& ctx = func.getContext();
+	Module* pm = func.getParent();
+	if (!hasBlockCounters(func)) {
+		return false;
+	}
+	unsigned firstCounter = FunctionCounters[&func].first;
+	BlockFrequencyInfo& BFI = getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
+	const BranchProbabilityInfo* BPI = BFI.getBPI();
+
+	std::vector<BasicBlock*> blocks;
+	std::map<BasicBlock*, unsigned> blockIndex;
+	for (BasicBlock& bBlock : func) {
+		blockIndex[&bBlock] = blocks.size();
+		blocks.push_back(&bBlock);
+	}
+	unsigned exitNode = blocks.size();
+
+	//  the virtual edge can't be instrumented at all
+	std::vector<CFGEdge> edges{ CFGEdge(exitNode, 0, 0, UINT64_MAX, true) };
+	for (unsigned i = 0; i < blocks.size(); ++i) {
+		BasicBlock* bBlock = blocks[i];
+		auto* terminator = bBlock->getTerminator();
+		unsigned numSuccessors = terminator->getNumSuccessors();
+		if (numSuccessors == 0) {
+			edges.push_back(CFGEdge(i, exitNode, 0, BFI.getBlockFreq(bBlock).getFrequency(), false));
+		}
+		else if (hasCallThatMayNotReturn(*bBlock)) {
+			edges.push_back(CFGEdge(i, exitNode, 0, 0, true));
+		}
+		for (unsigned s = 0; s < numSuccessors; ++s) {
+			BasicBlock* succ = terminator->getSuccessor(s);
+			uint64_t weight = (BFI.getBlockFreq(bBlock) * BPI->getEdgeProbability(bBlock, s)).getFrequency();
+			bool fixed = numSuccessors > 1 && (succ->isEHPad() || isa<IndirectBrInst>(terminator));
+			edges.push_back(CFGEdge(i, blockIndex[succ], s, weight, fixed));
+		}
+	}
+
+	//  Kruskal: fixed edges first, then by decreasing weight
+	std::vector<unsigned> order(edges.size());
+	for (unsigned e = 0; e < edges.size(); ++e) {
+		order[e] = e;
+	}
+	std::stable_sort(order.begin(), order.end(), [&edges](unsigned a, unsigned b) {
+		if (edges[a].Fixed != edges[b].Fixed) {
+			return edges[a].Fixed;
+		}
+		return edges[a].Weight > edges[b].Weight;
+	});
+	std::vector<unsigned> component(exitNode + 1);
+	for (unsigned n = 0; n <= exitNode; ++n) {
+		component[n] = n;
+	}
+	auto find = [&component](unsigned n) {
+		while (component[n] != n) {
+			n = component[n] = component[component[n]];
+		}
+		return n;
+	};
+	for (unsigned e : order) {
+		unsigned src = find(edges[e].Src), dst = find(edges[e].Dst);
+		if (src != dst) {
+			component[src] = dst;
+			edges[e].InTree = true;
+		}
+		else if (edges[e].Fixed) {
+			return false;
+		}
+	}
+
+	unsigned numCounters = 0;
+	std::vector<std::vector<unsigned>> incidentEdges(exitNode + 1);
+	for (unsigned e = 0; e < edges.size(); ++e) {
+		//  self loops are never tree edges and cancel out in the flow of their block
+		incidentEdges[edges[e].Src].push_back(e);
+		if (edges[e].Dst != edges[e].Src) {
+			incidentEdges[edges[e].Dst].push_back(e);
+		}
+		if (!edges[e].InTree) {
+			edges[e].Count[numCounters++] = 1;
+			edges[e].Known = true;
+		}
+	}
+	//  dense switches can need more edge counters than there are blocks
+	if (numCounters >= blocks.size()) {
+		return false;
+	}
+
+	//  solve the tree edges from the leaves inwards: in = out at every node
+	for (bool progress = true; progress; ) {
+		progress = false;
+		for (unsigned n = 0; n <= exitNode; ++n) {
+			CFGEdge* unknown = nullptr;
+			unsigned numUnknown = 0;
+			for (unsigned e : incidentEdges[n]) {
+				if (!edges[e].Known) {
+					unknown = &edges[e];
+					++numUnknown;
+				}
+			}
+			if (numUnknown != 1) {
+				continue;
+			}
+			//  unknown = (flow on the other side) - (flow on its own side)
+			int64_t sign = unknown->Dst == n ? 1 : -1;
+			for (unsigned e : incidentEdges[n]) {
+				if (!edges[e].Known || edges[e].Src == edges[e].Dst) {
+					continue;
+				}
+				int64_t edgeSign = edges[e].Dst == n ? -sign : sign;
+				for (auto& term : edges[e].Count) {
+					unknown->Count[term.first] += edgeSign * term.second;
+				}
+			}
+			unknown->Known = true;
+			progress = true;
+		}
+	}
+
+	GlobalVariable* counters = createCounterArray(*pm, numCounters, "cse231.cdi.edges");
+
+	for (CFGEdge& edge : edges) {
+		if (edge.InTree) {
+			continue;
+		}
+		BasicBlock* src = blocks[edge.Src];
+		Instruction* insertBefore;
+		//  a block without successors may end in unreachable after a noreturn call,
+		//  so its edge to the exit is counted when the block is entered
+		if (edge.Dst == exitNode) {
+			insertBefore = &*src->getFirstInsertionPt();
+		}
+		else if (src->getTerminator()->getNumSuccessors() == 1) {
+			insertBefore = src->getTerminator();
+		}
+		else if (blocks[edge.Dst]->getSinglePredecessor()) {
+			insertBefore = &*blocks[edge.Dst]->getFirstInsertionPt();
+		}
+		else {
+			insertBefore = SplitCriticalEdge(src->getTerminator(), edge.SuccIndex)->getTerminator();
+		}
+		insertCounterIncrement(insertBefore, counters, ConstantInt::get(Type::getInt32Ty(ctx), edge.Count.begin()->first));
+	}
+
+	std::vector<Value*> counterValues;
+	for (unsigned c = 0; c < numCounters; ++c) {
+		counterValues.push_back(insertCounterLoad(counters, c));
+	}
+	Value* blockCounters = IRBuilder<>(DumpPoint).CreateLoad(Counters->getValueType(), Counters);
+	//  a block count is the sum of its outgoing edge counts
+	for (unsigned i = 0; i < blocks.size(); ++i) {
+		std::map<unsigned, int64_t> blockCount;
+		for (unsigned e : incidentEdges[i]) {
+			if (edges[e].Src == i) {
+				for (auto& term : edges[e].Count) {
+					blockCount[term.first] += term.second;
+				}
+			}
+		}
+		IRBuilder<> dumpBuilder(DumpPoint);
+		Value* count = dumpBuilder.getInt64(0);
+		for (auto& term : blockCount) {
+			if (term.second != 0) {
+				count = dumpBuilder.CreateAdd(count, dumpBuilder.CreateMul(counterValues[term.first], dumpBuilder.getInt64(term.second)));
+			}
+		}
+		dumpBuilder.CreateStore(count, dumpBuilder.CreateConstInBoundsGEP1_32(dumpBuilder.getInt64Ty(), blockCounters, firstCounter + i));
+	}
+	return true;
+}
+
 bool CountDynamicInstructions::runOnFunction(Function& func) {
+	if (isInstrumentationFunction(func)) {
+		return false;
+	}
+
+	ValueToValueMapTy VMap;
+	Function* uninstrumented = SamplePeriod > 1 ? cloneForSampling(func, VMap) : nullptr;
+	if (!EdgeCounters || !instrumentEdges(func)) {
+		instrumentBlocks(func);
+	}
+	if (uninstrumented) {
+		//  edge counters need flow conservation and hoisted counters the whole loop
+		insertSampleDispatch(func, uninstrumented, VMap, "cse231.cdi.countdown", !InlineCounters && !EdgeCounters);
+	}
+	//  return true if the original function is modified
+	return true;
+}
+
+void CountDynamicInstructions::instrumentBlocks(Function& func) {
 	LLVMContext& ctx = func.getContext();
 	Module* pm = func.getParent();
 
+	bool inlineCounters = hasBlockCounters(func);
+	unsigned counter = inlineCounters ? FunctionCounters[&func].first : 0;
+
+	std::vector<CountedLoop> countedLoops;
+	std::map<BasicBlock*, unsigned> hoistedCounters;
+	if (inlineCounters) {
+		countedLoops = findCountedLoops(func);
+		for (CountedLoop& countedLoop : countedLoops) {
+			for (auto& block : countedLoop.Blocks) {
+				hoistedCounters[block.first] = 0;
+			}
+		}
+	}
+
 	for (BasicBlock& bBlock : func) {
+		if (inlineCounters) {
+			auto hoistedIter = hoistedCounters.find(&bBlock);
+			if (hoistedIter != hoistedCounters.end()) {
+				hoistedIter->second = counter;
+			}
+			else {
+				//  counted when entered, like the blocks of -cdi-edge-counters whose
+				//  call may not return
+				insertCounterIncrement(&*bBlock.getFirstInsertionPt(), Counters, ConstantInt::get(Type::getInt32Ty(ctx), counter));
+			}
+			++counter;
+			++NumBlockCounters;
+			continue;
+		}
+
 		//  store # of each instruction occurrence. use std::unordered_map if don't care about order.
 		std::map<uint32_t, uint32_t> instCount;
 		for (Instruction& inst : bBlock) {
@@ -49,25 +622,16 @@ bool CountDynamicInstructions::runOnFunction(Function& func) {
 		//  prepare function call arguments
 		unsigned size = instCount.size();
 		IntegerType* intTy = Type::getInt32Ty(ctx);
-		ArrayType* arrayTy = ArrayType::get(IntegerType::get(ctx, 32), size);
 
 		Constant* num = ConstantInt::get(intTy, size);
-		Constant* keyArray = ConstantDataArray::get(ctx, *(new ArrayRef<uint32_t>(keyVec)));
-		Constant* valArray = ConstantDataArray::get(ctx, *(new ArrayRef<uint32_t>(valVec)));
-
-		GlobalVariable* keyArgs = new GlobalVariable(
-			*pm,
-			arrayTy,
-			true,
-			GlobalValue::InternalLinkage,
-			keyArray);
-
-		GlobalVariable* valArgs = new GlobalVariable(
-			*pm,
-			arrayTy,
-			true,
-			GlobalValue::InternalLinkage,
-			valArray);
+		GlobalVariable* keyArgs = getHistogramArray(*pm, keyVec);
+
+		//  a sampled execution stands for getSampleWeight() of them
+		std::vector<uint64_t> weightedVec;
+		for (uint32_t val : valVec) {
+			weightedVec.push_back((uint64_t)val * getSampleWeight());
+		}
+		GlobalVariable* valArgs = getHistogramArray(*pm, weightedVec);
 
 		IRBuilder<> updateFuncBuilder(bBlock.getTerminator());
 
@@ -76,25 +640,24 @@ bool CountDynamicInstructions::runOnFunction(Function& func) {
 			Type::getVoidTy(ctx),
 			Type::getInt32Ty(ctx),
 			Type::getInt32PtrTy(ctx),
-			Type::getInt32PtrTy(ctx)
+			Type::getInt64PtrTy(ctx)
 		));
 
 		Value* key = updateFuncBuilder.CreatePointerCast(keyArgs, Type::getInt32PtrTy(ctx));
-		Value* val = updateFuncBuilder.CreatePointerCast(valArgs, Type::getInt32PtrTy(ctx));
+		Value* val = updateFuncBuilder.CreatePointerCast(valArgs, Type::getInt64PtrTy(ctx));
 
 		std::vector<Value*> updateFuncArgs{ num, key, val };
 
 		//  call function
 		updateFuncBuilder.CreateCall(updateFunc, updateFuncArgs);
 	}
-	IRBuilder<> printFuncBuilder(func.back().getTerminator());
-	Function* printFunc = cast<Function>(pm->getOrInsertFunction(
-		"printOutInstrInfo",
-		Type::getVoidTy(ctx)
-	));
-	printFuncBuilder.CreateCall(printFunc, std::vector<Value*>{});
-	//  return true if the original function is modified
-	return true;
+
+	//  after the histograms: the trip count computation isn't the program's
+	for (CountedLoop& countedLoop : countedLoops) {
+		insertLoopCounterIncrements(countedLoop, hoistedCounters);
+		NumHoistedCounters += countedLoop.Blocks.size();
+		++NumCountedLoops;
+	}
 }
 
 //  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
@@ -103,4 +666,4 @@ static RegisterPass<CountDynamicInstructions> cse231_cdi(
 	"cse231-cdi",
 	"cse231-cdi",
 	false,
-	false);
\ No newline at end of file
+	false);
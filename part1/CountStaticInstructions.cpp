@@ -1,33 +1,235 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
-#include <map>
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace llvm;
 
 namespace {
-    struct CountStaticInstructions : public FunctionPass {
-        static char ID;
-        CountStaticInstructions() : FunctionPass(ID) {}
+	enum OutputFormat { TableFormat, JSONFormat, CSVFormat };
+}
+
+static cl::opt<OutputFormat> Format(
+	"csi-format",
+	cl::desc("Output of cse231-csi"),
+	cl::values(
+		clEnumValN(TableFormat, "table", "opcode and count of every function, as it is run"),
+		clEnumValN(JSONFormat, "json", "one JSON object per module with its functions, one for the total at exit"),
+		clEnumValN(CSVFormat, "csv", "scope,module,function,opcode,count rows, the total at exit")),
+	cl::init(TableFormat));
+
+static cl::opt<unsigned> Threads(
+	"csi-threads",
+	cl::desc("Threads counting the functions of a module with -csi-format=json or csv (default: number of cores)"),
+	cl::init(0));
+
+namespace {
+	typedef std::array<uint64_t, Instruction::OtherOpsEnd> OpcodeCounts;
+
+	/*
+	 * The counts of all the modules of the process, printed when it exits:
+	 * cse231-driver runs the pass over many modules in one process. With -j,
+	 * each of its workers prints a total of its own; the driver adds them up
+	 * into a single total record and drops the CSV headers after the first.
+	 */
+	struct TotalCounts {
+		~TotalCounts();
+
+		std::mutex Lock;
+		OpcodeCounts Counts{};
+		unsigned NumModules = 0;
+		OutputFormat Format = TableFormat;
+	};
+
+	TotalCounts Total;
+
+	struct CountStaticInstructions : public FunctionPass {
+		static char ID;
+		CountStaticInstructions() : FunctionPass(ID) {}
+
+		virtual bool runOnFunction(Function& func) override;
+		virtual bool doFinalization(Module& module) override;
+	};
+}
+
+static void countOpcodes(const Function& func, OpcodeCounts& counts) {
+	for (const_inst_iterator iter = inst_begin(func); iter != inst_end(func); ++iter) {
+		++counts[iter->getOpcode()];
+	}
+}
+
+static uint64_t sumCounts(const OpcodeCounts& counts) {
+	uint64_t sum = 0;
+	for (uint64_t count : counts) {
+		sum += count;
+	}
+	return sum;
+}
+
+static json::Object toJSON(const OpcodeCounts& counts) {
+	json::Object opcodes;
+	for (unsigned opcode = 0; opcode < counts.size(); ++opcode) {
+		if (counts[opcode]) {
+			opcodes[Instruction::getOpcodeName(opcode)] = int64_t(counts[opcode]);
+		}
+	}
+	return opcodes;
+}
+
+//  a CSV field, quoted if it needs to be
+static std::string toCSV(StringRef field) {
+	if (field.find_first_of(",\"\n") == StringRef::npos) {
+		return field.str();
+	}
+	std::string quoted = "\"";
+	for (char c : field) {
+		quoted += c;
+		if (c == '"') {
+			quoted += '"';
+		}
+	}
+	return quoted + '"';
+}
+
+static void printCSVRows(raw_ostream& os, StringRef scope, StringRef module, StringRef function, const OpcodeCounts& counts) {
+	std::string prefix = toCSV(scope) + ',' + toCSV(module) + ',' + toCSV(function) + ',';
+	for (unsigned opcode = 0; opcode < counts.size(); ++opcode) {
+		if (counts[opcode]) {
+			os << prefix << Instruction::getOpcodeName(opcode) << ',' << counts[opcode] << '\n';
+		}
+	}
+}
+
+TotalCounts::~TotalCounts() {
+	if (!NumModules) {
+		return;
+	}
+	//  errs() may be gone by now
+	raw_fd_ostream os(2, false);
+	if (Format == JSONFormat) {
+		json::Object total{
+			{ "modules", int64_t(NumModules) },
+			{ "instructions", int64_t(sumCounts(Counts)) },
+			{ "opcodes", toJSON(Counts) }
+		};
+		os << json::Value(json::Object{ { "total", std::move(total) } }) << '\n';
+	}
+	else {
+		printCSVRows(os, "total", "", "", Counts);
+	}
+}
+
+bool CountStaticInstructions::runOnFunction(Function& func) {
+	if (Format != TableFormat) {
+		return false;
+	}
+	OpcodeCounts counts{};
+	countOpcodes(func, counts);
+	for (unsigned opcode = 0; opcode < counts.size(); ++opcode) {
+		if (counts[opcode]) {
+			errs() << Instruction::getOpcodeName(opcode) << '\t' << counts[opcode] << '\n';
+		}
+	}
+	return false;
+}
+
+//  -csi-format=json, csv: the whole module at once, its functions counted in parallel
+bool CountStaticInstructions::doFinalization(Module& module) {
+	if (Format == TableFormat) {
+		return false;
+	}
+
+	//  cse231-driver leaves the functions -functions doesn't select unmaterialized
+	std::vector<const Function*> functions;
+	for (const Function& func : module) {
+		if (!func.empty()) {
+			functions.push_back(&func);
+		}
+	}
+	std::vector<OpcodeCounts> counts(functions.size());
+
+	//  a thread isn't worth starting for less than this many functions
+	const unsigned MinFunctionsPerThread = 64;
+	unsigned numThreads = Threads ? Threads : hardware_concurrency();
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, functions.size() / MinFunctionsPerThread));
+	auto countChunk = [&](unsigned t) {
+		std::size_t begin = functions.size() * t / numThreads;
+		std::size_t end = functions.size() * (t + 1) / numThreads;
+		for (std::size_t i = begin; i < end; ++i) {
+			counts[i].fill(0);
+			countOpcodes(*functions[i], counts[i]);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t) {
+		threads.emplace_back(countChunk, t);
+	}
+	countChunk(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	OpcodeCounts moduleCounts{};
+	for (const OpcodeCounts& funcCounts : counts) {
+		for (unsigned opcode = 0; opcode < funcCounts.size(); ++opcode) {
+			moduleCounts[opcode] += funcCounts[opcode];
+		}
+	}
 
-        virtual bool runOnFunction(Function& func) override {
-            std::map<const char*, int> instCount;
-            for (auto iter = inst_begin(func); iter != inst_end(func); ++iter) {
-                ++instCount[iter->getOpcodeName()];
-            }
+	bool first;
+	{
+		std::lock_guard<std::mutex> guard(Total.Lock);
+		first = Total.NumModules++ == 0;
+		Total.Format = Format;
+		for (unsigned opcode = 0; opcode < moduleCounts.size(); ++opcode) {
+			Total.Counts[opcode] += moduleCounts[opcode];
+		}
+	}
 
-            for (auto& item : instCount) {
-                errs() << item.first << '\t' << item.second << '\n';
-            }
-	    return false;
-        }
-    };
+	if (Format == JSONFormat) {
+		//  one line per module, so that the outputs of many runs concatenate
+		json::Array functionObjects;
+		for (unsigned i = 0; i < functions.size(); ++i) {
+			functionObjects.push_back(json::Object{
+				{ "name", functions[i]->getName() },
+				{ "instructions", int64_t(sumCounts(counts[i])) },
+				{ "opcodes", toJSON(counts[i]) }
+			});
+		}
+		json::Object moduleObject{
+			{ "module", module.getModuleIdentifier() },
+			{ "instructions", int64_t(sumCounts(moduleCounts)) },
+			{ "opcodes", toJSON(moduleCounts) },
+			{ "functions", std::move(functionObjects) }
+		};
+		errs() << json::Value(std::move(moduleObject)) << '\n';
+	}
+	else {
+		if (first) {
+			errs() << "scope,module,function,opcode,count\n";
+		}
+		for (unsigned i = 0; i < functions.size(); ++i) {
+			printCSVRows(errs(), "function", module.getModuleIdentifier(), functions[i]->getName(), counts[i]);
+		}
+		printCSVRows(errs(), "module", module.getModuleIdentifier(), "", moduleCounts);
+	}
+	return false;
 }
 
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
 char CountStaticInstructions::ID = 0;
 static RegisterPass<CountStaticInstructions> cse231_csi(
-        "cse231-csi",
-        "cse231-csi",
-        false,
-        false);
+	"cse231-csi",
+	"cse231-csi",
+	false,
+	false);
@@ -0,0 +1,155 @@
+#include "231Instrumentation.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<bool> FunctionTiming(
+	"func-timing",
+	cl::desc("Also measure the inclusive and exclusive cycles of every function with the CPU's cycle counter"),
+	cl::init(false));
+
+/*
+ * Counts the calls of every function defined in the module and, with
+ * -func-timing, the cycles spent in it: inclusive of its callees, counted
+ * once for recursive activations, and exclusive of them. The runtime keeps a
+ * shadow stack of the activations of each thread to tell the two apart and
+ * prints the flat profile, by exclusive cycles, at exit.
+ */
+namespace {
+	struct FunctionProfiling : public FunctionPass {
+		static char ID;
+		FunctionProfiling() : FunctionPass(ID) {}
+
+		virtual bool doInitialization(Module& module) override;
+		virtual bool runOnFunction(Function& func) override;
+
+	private:
+		void insertTiming(Function& func, unsigned index);
+
+		//  an i64* to calls, inclusive and exclusive cycles of every function of the module
+		GlobalVariable* Counters = nullptr;
+		//  -func-timing: the thread local [n x i32] activations of each function on the stack
+		GlobalVariable* Depths = nullptr;
+		std::map<Function*, unsigned> FunctionIndex;
+	};
+}
+
+bool FunctionProfiling::doInitialization(Module& module) {
+	Counters = Depths = nullptr;
+	FunctionIndex.clear();
+
+	//  the profile is written once, when the program exits
+	Instruction* dumpPoint = createDumpFunction(module, "cse231.func.dump");
+
+	std::vector<Constant*> functionNames;
+	IRBuilder<> nameBuilder(dumpPoint);
+	for (Function& func : module) {
+		if (func.isDeclaration() || isInstrumentationFunction(func)) {
+			continue;
+		}
+		FunctionIndex[&func] = functionNames.size();
+		functionNames.push_back(cast<Constant>(nameBuilder.CreateGlobalStringPtr(func.getName())));
+	}
+	Counters = createRegisteredCounters(module, "registerFunctions", functionNames, 3, "cse231.func.counters");
+
+	if (FunctionTiming) {
+		if (SamplePeriod > 1) {
+			//  an exit needs its entry; the sampled calls couldn't be told from the others
+			errs() << "cse231-func: -func-timing counts every call; ignoring -cse231-sample-period\n";
+		}
+		ArrayType* depthsTy = ArrayType::get(Type::getInt32Ty(module.getContext()), functionNames.size());
+		Depths = new GlobalVariable(
+			module,
+			depthsTy,
+			false,
+			GlobalValue::InternalLinkage,
+			ConstantAggregateZero::get(depthsTy),
+			"cse231.func.depth",
+			nullptr,
+			GlobalVariable::GeneralDynamicTLSModel);
+	}
+	return true;
+}
+
+bool FunctionProfiling::runOnFunction(Function& func) {
+	//  functions added after doInitialization have no counters
+	auto funcIter = FunctionIndex.find(&func);
+	if (funcIter == FunctionIndex.end()) {
+		return false;
+	}
+	unsigned index = funcIter->second;
+
+	if (FunctionTiming) {
+		insertTiming(func, index);
+		return true;
+	}
+
+	ValueToValueMapTy VMap;
+	Function* uninstrumented = SamplePeriod > 1 ? cloneForSampling(func, VMap) : nullptr;
+	BasicBlock& entry = func.getEntryBlock();
+	insertCounterIncrement(&*entry.getFirstInsertionPt(), Counters, ConstantInt::get(Type::getInt32Ty(func.getContext()), 3 * index));
+	if (uninstrumented) {
+		insertSampleDispatch(func, uninstrumented, VMap, "cse231.func.countdown");
+	}
+	return true;
+}
+
+//  enterFunction at the entry, exitFunction at every ret and resume. frames left
+//  by longjmp or by an exception caught further up are popped by the runtime
+//  when a function below them returns
+void FunctionProfiling::insertTiming(Function& func, unsigned index) {
+	LLVMContext& ctx = func.getContext();
+	Module* pm = func.getParent();
+	Type* int64PtrTy = Type::getInt64PtrTy(ctx);
+
+	Function* enterFunc = cast<Function>(pm->getOrInsertFunction(
+		"enterFunction",
+		Type::getVoidTy(ctx),
+		int64PtrTy,
+		Type::getInt32PtrTy(ctx)
+	));
+	Function* exitFunc = cast<Function>(pm->getOrInsertFunction(
+		"exitFunction",
+		Type::getVoidTy(ctx),
+		int64PtrTy
+	));
+
+	std::vector<Instruction*> exits;
+	for (BasicBlock& bBlock : func) {
+		Instruction* terminator = bBlock.getTerminator();
+		if (isa<ReturnInst>(terminator) || isa<ResumeInst>(terminator)) {
+			//  nothing may come between a musttail call and its ret
+			CallInst* mustTailCall = bBlock.getTerminatingMustTailCall();
+			exits.push_back(mustTailCall ? mustTailCall : terminator);
+		}
+	}
+
+	//  the calls counter also counts the calls that never return
+	BasicBlock& entry = func.getEntryBlock();
+	Instruction* insertBefore = &*entry.getFirstInsertionPt();
+	insertCounterIncrement(insertBefore, Counters, ConstantInt::get(Type::getInt32Ty(ctx), 3 * index));
+	IRBuilder<> enterBuilder(insertBefore);
+	Value* counters = enterBuilder.CreateInBoundsGEP(enterBuilder.getInt64Ty(), enterBuilder.CreateLoad(int64PtrTy, Counters), enterBuilder.getInt64(3 * index));
+	Value* depth = enterBuilder.CreateConstInBoundsGEP2_32(Depths->getValueType(), Depths, 0, index);
+	enterBuilder.CreateCall(enterFunc, std::vector<Value*>{ counters, depth });
+
+	for (Instruction* exit : exits) {
+		IRBuilder<> exitBuilder(exit);
+		exitBuilder.CreateCall(exitFunc, std::vector<Value*>{ counters });
+	}
+}
+
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
+char FunctionProfiling::ID = 0;
+static RegisterPass<FunctionProfiling> cse231_func(
+	"cse231-func",
+	"cse231-func",
+	false,
+	false);
@@ -0,0 +1,237 @@
+#include "231Instrumentation.h"
+#include "../runtime/231Profile.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+#include <algorithm>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned> ColdCount(
+	"hotcold-max-count",
+	cl::desc("Blocks executed at most this many times are cold"),
+	cl::init(0));
+
+static cl::opt<unsigned> MinColdSize(
+	"hotcold-min-size",
+	cl::desc("Smallest cold region, in instructions, worth outlining"),
+	cl::init(3));
+
+/*
+ * Moves the code a -cdi-inline-counters or -cdi-edge-counters profile shows
+ * to be cold out of the hot text. A function whose entry never ran is marked
+ * cold as a whole; otherwise every cold block that isn't the entry is
+ * outlined together with the cold blocks it dominates that are only entered
+ * from within the region. Outlined functions are cold, minsize and go to the
+ * .text.unlikely section.
+ *
+ * Sizes are reported in IR instructions.
+ */
+namespace {
+	struct HotColdSplitting : public ModulePass {
+		static char ID;
+		HotColdSplitting() : ModulePass(ID) {}
+
+		virtual bool runOnModule(Module& module) override;
+
+	private:
+		bool readBlockCounts();
+		bool splitFunction(Function& func);
+
+		//  "function\tblock" -> executions
+		StringMap<uint64_t> BlockCounts;
+		unsigned NumHotInstrs = 0;
+		unsigned NumColdInstrs = 0;
+	};
+}
+
+static unsigned countInstructions(const BasicBlock& bBlock) {
+	return bBlock.size();
+}
+
+static unsigned countInstructions(const Function& func) {
+	unsigned size = 0;
+	for (const BasicBlock& bBlock : func) {
+		size += countInstructions(bBlock);
+	}
+	return size;
+}
+
+static void markCold(Function* func) {
+	func->addFnAttr(Attribute::Cold);
+	func->addFnAttr(Attribute::MinSize);
+	func->setSectionPrefix(".unlikely");
+}
+
+bool HotColdSplitting::readBlockCounts() {
+	BlockCounts.clear();
+	if (ProfileFilename.empty()) {
+		errs() << "cse231-hotcold: no -cse231-profile given\n";
+		return false;
+	}
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(ProfileFilename);
+	if (!buffer) {
+		errs() << "cse231-hotcold: " << ProfileFilename << ": " << buffer.getError().message() << '\n';
+		return false;
+	}
+
+	auto visit = [this](const cse231::RecordHeader& record, std::vector<std::string>& names, std::vector<uint64_t>& counters) {
+		if (record.Kind == cse231::BlockRecord) {
+			for (unsigned i = 0; i < names.size(); ++i) {
+				BlockCounts[names[i]] += counters[i];
+			}
+		}
+	};
+	std::string error;
+	StringRef data = (*buffer)->getBuffer();
+	if (!cse231::forEachRecord(data.data(), data.size(), visit, error)) {
+		errs() << "cse231-hotcold: " << ProfileFilename << ": " << error << '\n';
+		return false;
+	}
+	if (BlockCounts.empty()) {
+		errs() << "cse231-hotcold: " << ProfileFilename << " has no block counts (-cdi-inline-counters or -cdi-edge-counters)\n";
+		return false;
+	}
+	return true;
+}
+
+bool HotColdSplitting::splitFunction(Function& func) {
+	unsigned size = countInstructions(func);
+
+	//  the names are taken before anything is outlined: unnamed blocks are numbered
+	std::set<BasicBlock*> coldBlocks;
+	unsigned blockIndex = 0;
+	for (BasicBlock& bBlock : func) {
+		auto countIter = BlockCounts.find(getBlockName(&bBlock, blockIndex++));
+		if (countIter == BlockCounts.end()) {
+			//  not profiled, or changed since
+			NumHotInstrs += size;
+			return false;
+		}
+		if (countIter->second <= ColdCount) {
+			coldBlocks.insert(&bBlock);
+		}
+	}
+
+	if (coldBlocks.count(&func.getEntryBlock())) {
+		markCold(&func);
+		NumColdInstrs += size;
+		errs() << func.getName() << ": cold, " << size << " instructions\n";
+		return true;
+	}
+
+	unsigned numRegions = 0;
+	unsigned numOutlined = 0;
+	for (bool outlined = true; outlined; ) {
+		outlined = false;
+		DominatorTree DT(func);
+		for (BasicBlock& header : func) {
+			if (!coldBlocks.count(&header)) {
+				continue;
+			}
+			//  the cold blocks header dominates, less those entered from outside the
+			//  region: a hot block in between (-hotcold-max-count > 0) would give the
+			//  region a second entry. what is left over can head a region of its own.
+			std::set<BasicBlock*> members;
+			for (BasicBlock& bBlock : func) {
+				if (coldBlocks.count(&bBlock) && DT.dominates(&header, &bBlock)) {
+					members.insert(&bBlock);
+				}
+			}
+			for (bool pruned = true; pruned; ) {
+				pruned = false;
+				for (auto it = members.begin(); it != members.end(); ) {
+					bool entered = *it != &header && std::any_of(pred_begin(*it), pred_end(*it), [&members](BasicBlock* pred) {
+						return !members.count(pred);
+					});
+					if (entered) {
+						it = members.erase(it);
+						pruned = true;
+					}
+					else {
+						++it;
+					}
+				}
+			}
+			//  the header comes first: CodeExtractor takes it as the region entry
+			std::vector<BasicBlock*> region{ &header };
+			unsigned regionSize = countInstructions(header);
+			for (BasicBlock& bBlock : func) {
+				if (&bBlock != &header && members.count(&bBlock)) {
+					region.push_back(&bBlock);
+					regionSize += countInstructions(bBlock);
+				}
+			}
+			if (regionSize < MinColdSize) {
+				continue;
+			}
+			CodeExtractor extractor(region, &DT);
+			if (!extractor.isEligible()) {
+				continue;
+			}
+			Function* coldFunc = extractor.extractCodeRegion();
+			if (!coldFunc) {
+				continue;
+			}
+			markCold(coldFunc);
+			for (BasicBlock* bBlock : region) {
+				coldBlocks.erase(bBlock);
+			}
+			++numRegions;
+			numOutlined += regionSize;
+			//  the dominator tree is stale now
+			outlined = true;
+			break;
+		}
+	}
+
+	unsigned hotSize = countInstructions(func);
+	NumHotInstrs += hotSize;
+	NumColdInstrs += numOutlined;
+	if (numRegions) {
+		errs() << func.getName() << ": outlined " << numRegions << " cold regions, " << numOutlined
+			<< " of " << size << " instructions; " << hotSize << " left\n";
+	}
+	return numRegions != 0;
+}
+
+bool HotColdSplitting::runOnModule(Module& module) {
+	NumHotInstrs = NumColdInstrs = 0;
+	if (!readBlockCounts()) {
+		return false;
+	}
+
+	//  the outlined functions are added to the module as we go
+	std::vector<Function*> functions;
+	for (Function& func : module) {
+		if (!func.isDeclaration() && !isInstrumentationFunction(func)) {
+			functions.push_back(&func);
+		}
+	}
+	bool changed = false;
+	for (Function* func : functions) {
+		changed |= splitFunction(*func);
+	}
+
+	unsigned total = NumHotInstrs + NumColdInstrs;
+	errs() << "cse231-hotcold: hot text " << NumHotInstrs << " instructions, " << NumColdInstrs << " moved out ("
+		<< (total ? 100 * NumColdInstrs / total : 0) << "%)\n";
+	return changed;
+}
+
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
+char HotColdSplitting::ID = 0;
+static RegisterPass<HotColdSplitting> cse231_hotcold(
+	"cse231-hotcold",
+	"cse231-hotcold",
+	false,
+	false);
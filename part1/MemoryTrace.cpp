@@ -0,0 +1,207 @@
+#include "231Instrumentation.h"
+#include "llvm/Pass.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<bool> SkipLocals(
+	"memtrace-skip-locals",
+	cl::desc("Don't trace the loads and stores whose address can only be in an alloca of the function"),
+	cl::init(false));
+
+/*
+ * Records the address, size and site of every load and store in the trace
+ * of the runtime (231Trace.h), for cse231-reuse to compute reuse distances
+ * and strides from. The sites of a module are registered by its
+ * constructor, which gets their ids in the trace; the runtime buffers the
+ * accesses of each thread and writes them in blocks.
+ */
+namespace {
+	struct MemoryTrace : public FunctionPass {
+		static char ID;
+		MemoryTrace() : FunctionPass(ID) {}
+
+		virtual bool doInitialization(Module& module) override;
+		virtual bool runOnFunction(Function& func) override;
+
+	private:
+		bool isTraced(Instruction* instr);
+
+		//  the i32 trace id of the module's site 0, set by the module constructor
+		GlobalVariable* FirstSite = nullptr;
+		std::map<Instruction*, unsigned> SiteIndex;
+	};
+}
+
+static Value* getAccessedPointer(Instruction* instr) {
+	if (LoadInst* pLoadInst = dyn_cast<LoadInst>(instr)) {
+		return pLoadInst->getPointerOperand();
+	}
+	if (StoreInst* pStoreInst = dyn_cast<StoreInst>(instr)) {
+		return pStoreInst->getPointerOperand();
+	}
+	return nullptr;
+}
+
+//  "function\tblock\tlocation\tload 3", 3 being the position of the load in its block
+static std::string getAccessSiteName(Instruction* instr, unsigned blockIndex, unsigned instrIndex) {
+	std::string name;
+	raw_string_ostream nameStream(name);
+	nameStream << getBlockName(instr->getParent(), blockIndex) << '\t';
+	if (const DILocation* loc = instr->getDebugLoc()) {
+		nameStream << loc->getFilename() << ':' << loc->getLine() << ':' << loc->getColumn();
+	}
+	else {
+		nameStream << '?';
+	}
+	nameStream << '\t' << (isa<StoreInst>(instr) ? "store " : "load ") << instrIndex;
+	return nameStream.str();
+}
+
+bool MemoryTrace::isTraced(Instruction* instr) {
+	Value* pointer = getAccessedPointer(instr);
+	//  the runtime only takes addresses of the default address space
+	if (!pointer || pointer->getType()->getPointerAddressSpace() != 0) {
+		return false;
+	}
+	if (!SkipLocals) {
+		return true;
+	}
+	//  the stack of the function itself tells little about the caches
+	SmallVector<Value*, 4> objects;
+	GetUnderlyingObjects(pointer, objects, instr->getModule()->getDataLayout());
+	for (Value* object : objects) {
+		if (!isa<AllocaInst>(object)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MemoryTrace::doInitialization(Module& module) {
+	LLVMContext& ctx = module.getContext();
+	FirstSite = nullptr;
+	SiteIndex.clear();
+
+	//  the buffer of the exiting thread goes to the trace with the profile
+	Instruction* dumpPoint = createDumpFunction(module, "cse231.memtrace.dump");
+	IRBuilder<> dumpBuilder(dumpPoint);
+	Function* flushFunc = cast<Function>(module.getOrInsertFunction(
+		"flushTrace",
+		Type::getVoidTy(ctx)
+	));
+	dumpBuilder.CreateCall(flushFunc);
+
+	std::vector<Constant*> siteNames;
+	for (Function& func : module) {
+		if (isInstrumentationFunction(func)) {
+			continue;
+		}
+		unsigned blockIndex = 0;
+		for (BasicBlock& bBlock : func) {
+			unsigned instrIndex = 0;
+			for (Instruction& instr : bBlock) {
+				if (isTraced(&instr)) {
+					SiteIndex[&instr] = siteNames.size();
+					siteNames.push_back(cast<Constant>(dumpBuilder.CreateGlobalStringPtr(getAccessSiteName(&instr, blockIndex, instrIndex))));
+				}
+				++instrIndex;
+			}
+			++blockIndex;
+		}
+	}
+	if (siteNames.empty()) {
+		return true;
+	}
+
+	Type* intTy = Type::getInt32Ty(ctx);
+	Type* charPtrTy = Type::getInt8PtrTy(ctx);
+	ArrayType* namesTy = ArrayType::get(charPtrTy, siteNames.size());
+	GlobalVariable* namesTable = new GlobalVariable(
+		module,
+		namesTy,
+		true,
+		GlobalValue::InternalLinkage,
+		ConstantArray::get(namesTy, siteNames),
+		"cse231.memtrace.names");
+	FirstSite = new GlobalVariable(
+		module,
+		intTy,
+		false,
+		GlobalValue::InternalLinkage,
+		ConstantInt::get(intTy, 0),
+		"cse231.memtrace.first");
+
+	//  FirstSite = registerTraceSites(#sites, names)
+	IRBuilder<> initBuilder(createInitFunction(module, "cse231.memtrace.init"));
+	Function* registerFunc = cast<Function>(module.getOrInsertFunction(
+		"registerTraceSites",
+		intTy,
+		intTy,
+		PointerType::getUnqual(charPtrTy)
+	));
+	std::vector<Value*> registerArgs{
+		initBuilder.getInt32(siteNames.size()),
+		initBuilder.CreateConstInBoundsGEP2_32(namesTy, namesTable, 0, 0)
+	};
+	initBuilder.CreateStore(initBuilder.CreateCall(registerFunc, registerArgs), FirstSite);
+	return true;
+}
+
+bool MemoryTrace::runOnFunction(Function& func) {
+	if (!FirstSite || isInstrumentationFunction(func)) {
+		return false;
+	}
+	LLVMContext& ctx = func.getContext();
+	const DataLayout& layout = func.getParent()->getDataLayout();
+	Function* traceFunc = cast<Function>(func.getParent()->getOrInsertFunction(
+		"traceAccess",
+		Type::getVoidTy(ctx),
+		Type::getInt8PtrTy(ctx),
+		Type::getInt32Ty(ctx),
+		Type::getInt32Ty(ctx),
+		Type::getInt1Ty(ctx)
+	));
+
+	bool changed = false;
+	for (BasicBlock& bBlock : func) {
+		for (Instruction& instr : bBlock) {
+			//  accesses added after doInitialization have no site
+			auto siteIter = SiteIndex.find(&instr);
+			if (siteIter == SiteIndex.end()) {
+				continue;
+			}
+			Value* pointer = getAccessedPointer(&instr);
+			StoreInst* pStoreInst = dyn_cast<StoreInst>(&instr);
+			Type* accessedTy = pStoreInst ? pStoreInst->getValueOperand()->getType() : instr.getType();
+			IRBuilder<> traceBuilder(&instr);
+			Value* site = traceBuilder.CreateAdd(traceBuilder.CreateLoad(traceBuilder.getInt32Ty(), FirstSite), traceBuilder.getInt32(siteIter->second));
+			std::vector<Value*> traceArgs{
+				traceBuilder.CreatePointerCast(pointer, traceBuilder.getInt8PtrTy()),
+				site,
+				traceBuilder.getInt32(layout.getTypeStoreSize(accessedTy)),
+				traceBuilder.getInt1(pStoreInst != nullptr)
+			};
+			traceBuilder.CreateCall(traceFunc, traceArgs);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
+char MemoryTrace::ID = 0;
+static RegisterPass<MemoryTrace> cse231_memtrace(
+	"cse231-memtrace",
+	"cse231-memtrace",
+	false,
+	false);
@@ -0,0 +1,433 @@
+#include "231Instrumentation.h"
+#include "../runtime/231Profile.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned> MaxArrayPaths(
+	"paths-max-array",
+	cl::desc("Functions with more paths count them in a hash table instead of an array"),
+	cl::init(4096));
+
+static cl::opt<unsigned> HashTableSize(
+	"paths-hash-size",
+	cl::desc("Slots of the hash table of a function with too many paths for an array"),
+	cl::init(1024));
+
+static cl::opt<unsigned> HotPaths(
+	"paths-hot",
+	cl::desc("With -cse231-profile, the number of hottest paths to show for each function"),
+	cl::init(10));
+
+namespace {
+	/*
+	 * Ball-Larus numbering of the acyclic paths of a function. Retreating
+	 * edges, found by a depth first search from the entry, are replaced by a
+	 * dummy edge from the entry to their target and one from their source to
+	 * the virtual exit, node func.size(); blocks without successors get an
+	 * edge to the exit. Every path from the entry to the exit of that DAG
+	 * gets a number in [0, NumPaths), the sum of the values of its edges.
+	 */
+	struct PathNumbering {
+		enum EdgeKind { ForwardEdge, ReturnEdge, EntryDummy, ExitDummy };
+
+		struct PathEdge {
+			PathEdge(unsigned src, unsigned dst, unsigned succIndex, EdgeKind kind) :
+				Src(src), Dst(dst), SuccIndex(succIndex), Kind(kind) {}
+
+			unsigned Src, Dst;
+			//  successor index in the terminator of Src, for forward edges
+			unsigned SuccIndex;
+			EdgeKind Kind;
+			uint64_t Val = 0;
+		};
+
+		//  a retreating CFG edge and its two dummy edges
+		struct BackEdge {
+			unsigned Src, SuccIndex;
+			unsigned EntryDummy, ExitDummy;
+		};
+
+		bool build(Function& func);
+		std::string decode(uint64_t path) const;
+
+		std::vector<BasicBlock*> Blocks;
+		std::vector<PathEdge> Edges;
+		//  the DAG edges leaving each node, in increasing Val
+		std::vector<std::vector<unsigned>> OutEdges;
+		std::vector<BackEdge> BackEdges;
+		uint64_t NumPaths = 0;
+	};
+
+	struct PathProfiling : public FunctionPass {
+		static char ID;
+		PathProfiling() : FunctionPass(ID) {}
+
+		virtual bool doInitialization(Module& module) override;
+		virtual bool runOnFunction(Function& func) override;
+
+	private:
+		bool readPathCounts();
+		void reportHotPaths(Function& func, const PathNumbering& numbering);
+		void instrument(Function& func, const PathNumbering& numbering);
+		void insertPathCount(Instruction* insertBefore, AllocaInst* pathRegister, uint64_t val);
+
+		//  the writeProfile call at exit; null with -cse231-profile
+		Instruction* DumpPoint = nullptr;
+		//  the registerPaths calls of the functions go before it, in the module constructor
+		Instruction* InitPoint = nullptr;
+		//  an i64* global to the counters of the function being instrumented: an array
+		//  indexed by path, or a countPath table with TableCapacity slots
+		GlobalVariable* PathCounters = nullptr;
+		unsigned TableCapacity = 0;
+		//  -cse231-profile: function -> path, count
+		StringMap<std::vector<std::pair<std::string, uint64_t>>> PathCounts;
+	};
+}
+
+static std::string getShortBlockName(const BasicBlock* bBlock, unsigned blockIndex) {
+	if (bBlock->hasName()) {
+		return bBlock->getName().str();
+	}
+	return "bb" + std::to_string(blockIndex);
+}
+
+/*
+ * Returns false if the function has more paths than fit in 63 bits.
+ */
+bool PathNumbering::build(Function& func) {
+	std::map<BasicBlock*, unsigned> blockIndex;
+	for (BasicBlock& bBlock : func) {
+		blockIndex[&bBlock] = Blocks.size();
+		Blocks.push_back(&bBlock);
+	}
+	unsigned exitNode = Blocks.size();
+	OutEdges.resize(exitNode + 1);
+
+	//  retreating edges: the target is still on the DFS stack
+	enum { Unvisited, OnStack, Done };
+	std::vector<int> state(exitNode, Unvisited);
+	std::vector<std::pair<unsigned, unsigned>> stack{ std::make_pair(0u, 0u) };
+	state[0] = OnStack;
+	while (!stack.empty()) {
+		unsigned node = stack.back().first;
+		unsigned succIndex = stack.back().second++;
+		auto* terminator = Blocks[node]->getTerminator();
+		if (terminator->getNumSuccessors() == 0 && succIndex == 0) {
+			Edges.push_back(PathEdge(node, exitNode, 0, ReturnEdge));
+			OutEdges[node].push_back(Edges.size() - 1);
+		}
+		if (succIndex >= terminator->getNumSuccessors()) {
+			state[node] = Done;
+			stack.pop_back();
+			continue;
+		}
+		unsigned succ = blockIndex[terminator->getSuccessor(succIndex)];
+		if (state[succ] == OnStack) {
+			BackEdge backEdge{ node, succIndex, (unsigned)Edges.size(), (unsigned)Edges.size() + 1 };
+			Edges.push_back(PathEdge(0, succ, 0, EntryDummy));
+			OutEdges[0].push_back(backEdge.EntryDummy);
+			Edges.push_back(PathEdge(node, exitNode, 0, ExitDummy));
+			OutEdges[node].push_back(backEdge.ExitDummy);
+			BackEdges.push_back(backEdge);
+			continue;
+		}
+		Edges.push_back(PathEdge(node, succ, succIndex, ForwardEdge));
+		OutEdges[node].push_back(Edges.size() - 1);
+		if (state[succ] == Unvisited) {
+			state[succ] = OnStack;
+			stack.push_back(std::make_pair(succ, 0u));
+		}
+	}
+
+	//  number the paths in reverse topological order of the DAG
+	std::vector<uint64_t> numPaths(exitNode + 1, 0);
+	numPaths[exitNode] = 1;
+	std::vector<int> dagState(exitNode + 1, Unvisited);
+	std::vector<std::pair<unsigned, unsigned>> dagStack{ std::make_pair(0u, 0u) };
+	dagState[0] = OnStack;
+	while (!dagStack.empty()) {
+		unsigned node = dagStack.back().first;
+		unsigned edgeIndex = dagStack.back().second++;
+		if (edgeIndex < OutEdges[node].size()) {
+			unsigned succ = Edges[OutEdges[node][edgeIndex]].Dst;
+			if (dagState[succ] == Unvisited && succ != exitNode) {
+				dagState[succ] = OnStack;
+				dagStack.push_back(std::make_pair(succ, 0u));
+			}
+			continue;
+		}
+		dagStack.pop_back();
+		dagState[node] = Done;
+		for (unsigned e : OutEdges[node]) {
+			Edges[e].Val = numPaths[node];
+			if (numPaths[Edges[e].Dst] > (UINT64_MAX >> 1) - numPaths[node]) {
+				return false;
+			}
+			numPaths[node] += numPaths[Edges[e].Dst];
+		}
+	}
+	NumPaths = numPaths[0];
+	return true;
+}
+
+//  "entry -> b -> c", with "(back edge)" where the path starts or ends at one
+std::string PathNumbering::decode(uint64_t path) const {
+	std::string blocks = getShortBlockName(Blocks[0], 0);
+	unsigned node = 0;
+	while (node != Blocks.size()) {
+		//  the edge with the largest value not above what is left of path
+		const PathEdge* taken = nullptr;
+		for (unsigned e : OutEdges[node]) {
+			if (Edges[e].Val <= path) {
+				taken = &Edges[e];
+			}
+		}
+		if (!taken) {
+			return "?";
+		}
+		path -= taken->Val;
+		switch (taken->Kind) {
+		case EntryDummy:
+			blocks = "(back edge) " + getShortBlockName(Blocks[taken->Dst], taken->Dst);
+			break;
+		case ExitDummy:
+			blocks += " (back edge)";
+			break;
+		case ForwardEdge:
+			blocks += " -> " + getShortBlockName(Blocks[taken->Dst], taken->Dst);
+			break;
+		case ReturnEdge:
+			break;
+		}
+		node = taken->Dst;
+	}
+	return blocks;
+}
+
+bool PathProfiling::readPathCounts() {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(ProfileFilename);
+	if (!buffer) {
+		errs() << "cse231-paths: " << ProfileFilename << ": " << buffer.getError().message() << '\n';
+		return false;
+	}
+	auto visit = [this](const cse231::RecordHeader& record, std::vector<std::string>& names, std::vector<uint64_t>& counters) {
+		if (record.Kind != cse231::PathRecord) {
+			return;
+		}
+		for (unsigned i = 0; i < names.size(); ++i) {
+			std::pair<StringRef, StringRef> name = StringRef(names[i]).split('\t');
+			PathCounts[name.first].push_back(std::make_pair(name.second.str(), counters[i]));
+		}
+	};
+	std::string error;
+	StringRef data = (*buffer)->getBuffer();
+	if (!cse231::forEachRecord(data.data(), data.size(), visit, error)) {
+		errs() << "cse231-paths: " << ProfileFilename << ": " << error << '\n';
+		return false;
+	}
+	return true;
+}
+
+bool PathProfiling::doInitialization(Module& module) {
+	DumpPoint = InitPoint = nullptr;
+	PathCounts.clear();
+
+	//  with a profile the pass only shows the hot paths
+	if (!ProfileFilename.empty()) {
+		readPathCounts();
+		return false;
+	}
+	DumpPoint = createDumpFunction(module, "cse231.paths.dump");
+	InitPoint = createInitFunction(module, "cse231.paths.init");
+	return true;
+}
+
+//  "function\tcount\tpath\tblocks" for the HotPaths hottest paths of func
+void PathProfiling::reportHotPaths(Function& func, const PathNumbering& numbering) {
+	auto countIter = PathCounts.find(func.getName());
+	if (countIter == PathCounts.end()) {
+		return;
+	}
+	std::vector<std::pair<std::string, uint64_t>> paths = countIter->second;
+	std::stable_sort(paths.begin(), paths.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+		return a.second > b.second;
+	});
+	if (paths.size() > HotPaths) {
+		paths.resize(HotPaths);
+	}
+	for (auto& path : paths) {
+		errs() << func.getName() << '\t' << path.second << '\t' << path.first << '\t';
+		uint64_t pathNumber;
+		if (path.first == "lost") {
+			errs() << "(the hash table was full)\n";
+		}
+		else if (StringRef(path.first).getAsInteger(10, pathNumber) || pathNumber >= numbering.NumPaths) {
+			errs() << "?\n";
+		}
+		else {
+			errs() << numbering.decode(pathNumber) << '\n';
+		}
+	}
+}
+
+//  count the path in the path register plus val before insertBefore
+void PathProfiling::insertPathCount(Instruction* insertBefore, AllocaInst* pathRegister, uint64_t val) {
+	IRBuilder<> countBuilder(insertBefore);
+	Value* path = countBuilder.CreateLoad(countBuilder.getInt64Ty(), pathRegister);
+	if (val) {
+		path = countBuilder.CreateAdd(path, countBuilder.getInt64(val));
+	}
+	if (!TableCapacity) {
+		insertCounterIncrement(insertBefore, PathCounters, countBuilder.CreateTrunc(path, countBuilder.getInt32Ty()));
+		return;
+	}
+	Module* pm = insertBefore->getModule();
+	Function* countFunc = cast<Function>(pm->getOrInsertFunction(
+		"countPath",
+		countBuilder.getVoidTy(),
+		countBuilder.getInt64Ty()->getPointerTo(),
+		countBuilder.getInt32Ty(),
+		countBuilder.getInt64Ty(),
+		countBuilder.getInt32Ty()
+	));
+	std::vector<Value*> countArgs{
+		countBuilder.CreateLoad(PathCounters->getValueType(), PathCounters),
+		countBuilder.getInt32(TableCapacity),
+		path,
+		countBuilder.getInt32(getSampleWeight())
+	};
+	countBuilder.CreateCall(countFunc, countArgs);
+}
+
+//  the edge from src to its successor succIndex: its source, its target or a new block
+static Instruction* getEdgeInsertPoint(BasicBlock* src, unsigned succIndex) {
+	auto* terminator = src->getTerminator();
+	BasicBlock* dst = terminator->getSuccessor(succIndex);
+	if (terminator->getNumSuccessors() == 1) {
+		return terminator;
+	}
+	if (dst->getSinglePredecessor()) {
+		return &*dst->getFirstInsertionPt();
+	}
+	return SplitCriticalEdge(terminator, succIndex)->getTerminator();
+}
+
+/*
+ * The path register starts at 0 in the entry block and adds the value of
+ * every forward edge that has one. Returns count the path; back edges count
+ * it with the value of their exit dummy and restart the register at the
+ * value of their entry dummy.
+ */
+void PathProfiling::instrument(Function& func, const PathNumbering& numbering) {
+	Module* pm = func.getParent();
+	LLVMContext& ctx = func.getContext();
+	Type* int64Ty = Type::getInt64Ty(ctx);
+
+	//  counters = registerPaths(name, #paths, capacity) in the module constructor
+	Function* registerFunc = cast<Function>(pm->getOrInsertFunction(
+		"registerPaths",
+		int64Ty->getPointerTo(),
+		Type::getInt8PtrTy(ctx),
+		Type::getInt32Ty(ctx),
+		Type::getInt32Ty(ctx)
+	));
+	IRBuilder<> initBuilder(InitPoint);
+	if (numbering.NumPaths <= MaxArrayPaths) {
+		TableCapacity = 0;
+		Value* registerArgs[] = { initBuilder.CreateGlobalStringPtr(func.getName()), initBuilder.getInt32(numbering.NumPaths), initBuilder.getInt32(0) };
+		PathCounters = createRegisteredCounters(InitPoint, registerFunc, registerArgs, numbering.NumPaths, "cse231.paths.counters");
+	}
+	else {
+		TableCapacity = std::max(1u, (unsigned)HashTableSize);
+		Value* registerArgs[] = { initBuilder.CreateGlobalStringPtr(func.getName()), initBuilder.getInt32(0), initBuilder.getInt32(TableCapacity) };
+		PathCounters = createRegisteredCounters(InitPoint, registerFunc, registerArgs, 2 * TableCapacity + 1, "cse231.paths.table");
+	}
+
+	IRBuilder<> entryBuilder(&*func.getEntryBlock().getFirstInsertionPt());
+	AllocaInst* pathRegister = entryBuilder.CreateAlloca(int64Ty, nullptr, "cse231.path");
+	entryBuilder.CreateStore(ConstantInt::get(int64Ty, 0), pathRegister);
+
+	//  all insertion points are taken after the increments are known: splitting
+	//  an edge keeps the successor indices
+	for (const PathNumbering::PathEdge& edge : numbering.Edges) {
+		if (edge.Kind == PathNumbering::ForwardEdge && edge.Val) {
+			IRBuilder<> edgeBuilder(getEdgeInsertPoint(numbering.Blocks[edge.Src], edge.SuccIndex));
+			Value* path = edgeBuilder.CreateLoad(int64Ty, pathRegister);
+			edgeBuilder.CreateStore(edgeBuilder.CreateAdd(path, ConstantInt::get(int64Ty, edge.Val)), pathRegister);
+		}
+		else if (edge.Kind == PathNumbering::ReturnEdge && !isa<UnreachableInst>(numbering.Blocks[edge.Src]->getTerminator())) {
+			insertPathCount(numbering.Blocks[edge.Src]->getTerminator(), pathRegister, edge.Val);
+		}
+	}
+	for (const PathNumbering::BackEdge& backEdge : numbering.BackEdges) {
+		Instruction* insertBefore = getEdgeInsertPoint(numbering.Blocks[backEdge.Src], backEdge.SuccIndex);
+		insertPathCount(insertBefore, pathRegister, numbering.Edges[backEdge.ExitDummy].Val);
+		IRBuilder<> edgeBuilder(insertBefore);
+		edgeBuilder.CreateStore(ConstantInt::get(int64Ty, numbering.Edges[backEdge.EntryDummy].Val), pathRegister);
+	}
+}
+
+bool PathProfiling::runOnFunction(Function& func) {
+	if (isInstrumentationFunction(func)) {
+		return false;
+	}
+
+	PathNumbering numbering;
+	if (!numbering.build(func)) {
+		errs() << func.getName() << ": too many paths, not profiled\n";
+		return false;
+	}
+	if (!DumpPoint) {
+		reportHotPaths(func, numbering);
+		return false;
+	}
+
+	//  edges that would need a new block but can't have one
+	auto isPlaceable = [](BasicBlock* src, unsigned succIndex) {
+		auto* terminator = src->getTerminator();
+		BasicBlock* dst = terminator->getSuccessor(succIndex);
+		return terminator->getNumSuccessors() == 1 || dst->getSinglePredecessor()
+			|| (!dst->isEHPad() && !isa<IndirectBrInst>(terminator));
+	};
+	for (const PathNumbering::PathEdge& edge : numbering.Edges) {
+		if (edge.Kind == PathNumbering::ForwardEdge && edge.Val && !isPlaceable(numbering.Blocks[edge.Src], edge.SuccIndex)) {
+			errs() << func.getName() << ": an edge can't be instrumented, not profiled\n";
+			return false;
+		}
+	}
+	for (const PathNumbering::BackEdge& backEdge : numbering.BackEdges) {
+		if (!isPlaceable(numbering.Blocks[backEdge.Src], backEdge.SuccIndex)) {
+			errs() << func.getName() << ": an edge can't be instrumented, not profiled\n";
+			return false;
+		}
+	}
+
+	ValueToValueMapTy VMap;
+	Function* uninstrumented = SamplePeriod > 1 ? cloneForSampling(func, VMap) : nullptr;
+	instrument(func, numbering);
+	if (uninstrumented) {
+		insertSampleDispatch(func, uninstrumented, VMap, "cse231.paths.countdown");
+	}
+	return true;
+}
+
+//  the value of ID doesn't matter. Its address is used to identify an LLVM pass.
+char PathProfiling::ID = 0;
+static RegisterPass<PathProfiling> cse231_paths(
+	"cse231-paths",
+	"cse231-paths",
+	false,
+	false);
@@ -0,0 +1,215 @@
+//===- 231Profile.h - Binary profile format of the CSE 231 runtime -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the layout of the profiles written by the runtime and
+// read by cse231-profdata
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231PROFILE_H
+#define LLVM_TRANSFORMS_231PROFILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace cse231 {
+
+/*
+ * A profile is a ProfileHeader followed by records, all in host byte order
+ * and 8 byte aligned:
+ *
+ *   RecordHeader
+ *   char     Names[NamesSize]        NUL terminated strings, padded to 8 bytes
+ *   uint64_t Counters[NumCounters]
+ *
+ * The runtime maps the file and appends a record whenever a counter set shows
+ * up; the counters are then updated in place. ProfileHeader::Size only covers
+ * complete records, so a profile is readable at any time.
+ */
+static const char ProfileMagic[8] = { 'C', 'S', 'E', '2', '3', '1', 'P', 'F' };
+static const uint32_t ProfileVersion = 1;
+
+struct ProfileHeader {
+	char Magic[8];
+	uint32_t Version;
+	uint32_t NumRecords;
+	//  bytes in use, header included
+	uint64_t Size;
+};
+
+enum RecordKind : uint32_t {
+	//  one name and one counter per opcode
+	OpcodeRecord = 1,
+	//  no names; taken and total of cse231-bb
+	BranchRecord = 2,
+	//  one "function\tblock\tlocation" name and a taken, not taken pair per site
+	SiteRecord = 3,
+	//  one "function\tblock" name and execution count per basic block
+	BlockRecord = 4,
+	//  one "function\tpath" name and execution count per Ball-Larus path that ran;
+	//  "function\tlost" counts the paths that found a full hash table
+	PathRecord = 5,
+	//  one function name and calls, inclusive and exclusive cycles per function
+	FunctionRecord = 6,
+	//  the counters of cse231-paths for one function, written by the runtime and
+	//  visited as a PathRecord: the function name and a counter per path number
+	PathArrayRecord = 7,
+	//  the same with the hash table of countPath: the function name, NumCounters / 2
+	//  (path + 1, count) slots and the count of the paths that found it full
+	PathTableRecord = 8,
+};
+
+struct RecordHeader {
+	uint32_t Kind;
+	uint32_t NumCounters;
+	uint64_t NamesSize;
+};
+
+inline uint64_t alignRecordSize(uint64_t size) {
+	return (size + 7) & ~uint64_t(7);
+}
+
+inline uint64_t getRecordSize(const RecordHeader& record) {
+	return sizeof(RecordHeader) + alignRecordSize(record.NamesSize) + record.NumCounters * sizeof(uint64_t);
+}
+
+/*
+ * The "function\tpath" names and counts of the paths that ran, from the
+ * counters of a PathArrayRecord or PathTableRecord of function.
+ */
+inline void expandPathCounters(uint32_t kind, const std::string& function, const uint64_t* counters, uint32_t numCounters,
+							   std::vector<std::string>& names, std::vector<uint64_t>& counts) {
+	auto addPath = [&](const std::string& path, uint64_t count) {
+		if (count) {
+			names.push_back(function + '\t' + path);
+			counts.push_back(count);
+		}
+	};
+	if (kind == PathArrayRecord) {
+		for (uint32_t path = 0; path < numCounters; ++path) {
+			addPath(std::to_string(path), counters[path]);
+		}
+		return;
+	}
+	for (uint32_t slot = 0; slot < numCounters / 2; ++slot) {
+		if (counters[2 * slot]) {
+			addPath(std::to_string(counters[2 * slot] - 1), counters[2 * slot + 1]);
+		}
+	}
+	addPath("lost", counters[numCounters - 1]);
+}
+
+inline bool isProfile(const void* data, uint64_t size) {
+	return size >= sizeof(ProfileHeader) && memcmp(data, ProfileMagic, sizeof(ProfileMagic)) == 0;
+}
+
+/*
+ * Calls visit(const RecordHeader&, std::vector<std::string>& names,
+ * std::vector<uint64_t>& counters) for every record of the profile in
+ * data; the path counters of the runtime come as PathRecords. Returns false,
+ * with a message in error, if it isn't a well formed profile of this version.
+ */
+template <class Visitor>
+bool forEachRecord(const char* data, uint64_t size, Visitor visit, std::string& error) {
+	if (!isProfile(data, size)) {
+		error = "not a cse231 profile";
+		return false;
+	}
+	ProfileHeader header;
+	memcpy(&header, data, sizeof(ProfileHeader));
+	if (header.Version != ProfileVersion || header.Size > size || header.Size < sizeof(ProfileHeader)) {
+		error = "unsupported or truncated profile";
+		return false;
+	}
+
+	uint64_t offset = sizeof(ProfileHeader);
+	for (uint32_t r = 0; r < header.NumRecords; ++r) {
+		//  each field is checked against what is left before any arithmetic on it,
+		//  so that no crafted size can wrap around
+		RecordHeader record;
+		uint64_t remaining = header.Size - offset;
+		if (remaining < sizeof(RecordHeader)) {
+			error = "truncated record";
+			return false;
+		}
+		memcpy(&record, data + offset, sizeof(RecordHeader));
+		remaining -= sizeof(RecordHeader);
+		if (record.NamesSize > remaining || alignRecordSize(record.NamesSize) > remaining
+			|| record.NumCounters > (remaining - alignRecordSize(record.NamesSize)) / sizeof(uint64_t)) {
+			error = "truncated record";
+			return false;
+		}
+
+		std::vector<std::string> names;
+		const char* name = data + offset + sizeof(RecordHeader);
+		const char* namesEnd = name + record.NamesSize;
+		while (name < namesEnd) {
+			const char* nameEnd = static_cast<const char*>(memchr(name, '\0', namesEnd - name));
+			if (!nameEnd) {
+				error = "malformed record names";
+				return false;
+			}
+			names.push_back(std::string(name, nameEnd));
+			name = nameEnd + 1;
+		}
+		std::vector<uint64_t> counters(record.NumCounters);
+		if (!counters.empty()) {
+			memcpy(counters.data(), data + offset + sizeof(RecordHeader) + alignRecordSize(record.NamesSize), record.NumCounters * sizeof(uint64_t));
+		}
+		offset += getRecordSize(record);
+
+		bool wellFormed;
+		switch (record.Kind) {
+		case OpcodeRecord:
+			wellFormed = names.size() == record.NumCounters;
+			break;
+		case BranchRecord:
+			wellFormed = record.NumCounters == 2;
+			break;
+		case BlockRecord:
+		case PathRecord:
+			wellFormed = names.size() == record.NumCounters;
+			break;
+		case SiteRecord:
+			wellFormed = 2 * names.size() == record.NumCounters;
+			break;
+		case FunctionRecord:
+			wellFormed = 3 * names.size() == record.NumCounters;
+			break;
+		case PathArrayRecord:
+		case PathTableRecord:
+			wellFormed = names.size() == 1 && (record.Kind == PathArrayRecord || record.NumCounters % 2 == 1);
+			if (wellFormed) {
+				std::string function = names[0];
+				std::vector<uint64_t> counts;
+				names.clear();
+				expandPathCounters(record.Kind, function, counters.data(), record.NumCounters, names, counts);
+				counters.swap(counts);
+				record.Kind = PathRecord;
+				record.NumCounters = counters.size();
+			}
+			break;
+		default:
+			//  records of later versions of the runtime are skipped
+			continue;
+		}
+		if (!wellFormed) {
+			error = "malformed record";
+			return false;
+		}
+		visit(record, names, counters);
+	}
+	return true;
+}
+
+}
+
+#endif
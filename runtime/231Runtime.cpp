@@ -0,0 +1,680 @@
+#include "231Runtime.h"
+#include "231Profile.h"
+#include "231Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+using namespace cse231;
+
+namespace {
+	//  the opcode numbers of llvm::Instruction, from the same list. Only the list is
+	//  included so that the programs the runtime goes into don't link against LLVM
+	struct Opcode {
+		enum : unsigned {
+#define HANDLE_INST(N, OPC, CLASS) OPC = N,
+#define LAST_OTHER_INST(N) OtherOpsEnd = N + 1
+#include "llvm/IR/Instruction.def"
+		};
+	};
+
+	/*
+	 * The counters of one thread. Only the owner writes them; the relaxed
+	 * atomics only make the concurrent reads of the flushes well defined and
+	 * compile to plain loads and stores.
+	 */
+	struct Shard {
+		Shard();
+		~Shard();
+
+		void add(std::atomic<uint64_t>& counter, uint64_t value) {
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t> Instrs[Opcode::OtherOpsEnd];
+		std::atomic<uint64_t> Taken;
+		std::atomic<uint64_t> Total;
+		//  the part already added to the process totals, guarded by Registry::Lock
+		uint64_t FlushedInstrs[Opcode::OtherOpsEnd];
+		uint64_t FlushedTaken;
+		uint64_t FlushedTotal;
+	};
+
+	//  branch sites or blocks
+	struct CounterTable {
+		std::vector<std::string> Names;
+		uint64_t* Counters;
+	};
+
+	//  the path counters of a function, see PathArrayRecord and PathTableRecord
+	struct PathTable {
+		RecordKind Kind;
+		std::string Function;
+		uint64_t* Counters;
+		uint32_t NumCounters;
+	};
+
+	/*
+	 * The process totals. With a profile file they live in its mapping, so
+	 * there is nothing left to serialize at exit.
+	 */
+	struct Registry {
+		Registry();
+
+		void flush(Shard& shard);
+		void flushAll();
+		uint64_t* allocateCounters(RecordKind kind, const std::vector<std::string>& names, uint32_t numCounters);
+
+		std::mutex Lock;
+		std::vector<Shard*> Live;
+		uint64_t* Instrs;
+		//  taken, total
+		uint64_t* Branches;
+		std::vector<CounterTable> Sites;
+		std::vector<CounterTable> Blocks;
+		std::vector<PathTable> Paths;
+		std::vector<CounterTable> Functions;
+
+		//  CSE231_PROFILE=- prints text to stderr from writeProfile instead
+		bool TextMode = false;
+		char* Base = nullptr;
+		int FD = -1;
+		uint64_t FileSize = 0;
+	};
+
+	//  address space reserved for the mapping, so that counters never move
+	const uint64_t ReservedSize = uint64_t(1) << 30;
+
+	//  never destroyed: thread exits may still retire shards during static destruction
+	Registry& getRegistry() {
+		static Registry* registry = new Registry;
+		return *registry;
+	}
+
+	thread_local Shard LocalShard;
+	//  module destructors still count after the thread_local shard of the exiting thread is gone
+	enum ShardState { ShardUnused, ShardLive, ShardRetired };
+	thread_local ShardState LocalShardState = ShardUnused;
+
+	//  an activation on the shadow stack of cse231-func -func-timing
+	struct ShadowFrame {
+		uint64_t* Counters;
+		uint32_t* Depth;
+		uint64_t Start;
+		//  inclusive cycles of the callees
+		uint64_t Callees;
+	};
+
+	//  plain data, so that it outlives the thread_local destructors for the module destructors
+	const unsigned MaxShadowFrames = 1024;
+	thread_local ShadowFrame ShadowStack[MaxShadowFrames];
+	thread_local unsigned ShadowDepth = 0;
+	//  activations past MaxShadowFrames, not timed
+	thread_local unsigned ShadowOverflow = 0;
+
+	/*
+	 * The trace of cse231-memtrace, opened when the first module registers
+	 * its sites. The threads buffer their accesses and append them in blocks.
+	 */
+	struct Tracer {
+		Tracer();
+
+		void write(TraceBlockKind kind, uint32_t id, const void* payload, uint64_t size);
+
+		std::mutex Lock;
+		int FD = -1;
+		uint32_t NumSites = 0;
+		uint32_t NumThreads = 0;
+	};
+
+	//  never destroyed, like the registry
+	Tracer& getTracer() {
+		static Tracer* tracer = new Tracer;
+		return *tracer;
+	}
+
+	//  the accesses of this thread not yet in the trace; plain data, so that the
+	//  module destructors can still trace after the thread_local destructors
+	const unsigned TraceBufferSize = 4096;
+	thread_local TraceAccess TraceBuffer[TraceBufferSize];
+	thread_local unsigned TraceBuffered = 0;
+	thread_local uint32_t TraceThread = UINT32_MAX;
+
+	void flushTraceBuffer() {
+		if (!TraceBuffered) {
+			return;
+		}
+		Tracer& tracer = getTracer();
+		std::lock_guard<std::mutex> guard(tracer.Lock);
+		if (TraceThread == UINT32_MAX) {
+			TraceThread = tracer.NumThreads++;
+		}
+		tracer.write(TraceAccessBlock, TraceThread, TraceBuffer, TraceBuffered * sizeof(TraceAccess));
+		TraceBuffered = 0;
+	}
+
+	//  writes out the buffer of an exiting thread
+	struct TraceFlusher {
+		~TraceFlusher() {
+			flushTraceBuffer();
+		}
+
+		bool Live = false;
+	};
+	thread_local TraceFlusher LocalTraceFlusher;
+	thread_local bool TraceFlusherLive = false;
+
+	uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+	}
+
+	//  nullptr once the shard of this thread is retired
+	Shard* getLocalShard() {
+		if (LocalShardState == ShardRetired) {
+			return nullptr;
+		}
+		return &LocalShard;
+	}
+
+	//  $variable with %p replaced by the process id; defaultPattern if it isn't set
+	std::string getOutputPath(const char* variable, const char* defaultPattern) {
+		const char* pattern = getenv(variable);
+		if (!pattern || !*pattern) {
+			pattern = defaultPattern;
+		}
+		std::string path;
+		for (const char* c = pattern; *c; ++c) {
+			if (c[0] == '%' && c[1] == 'p') {
+				path += std::to_string(getpid());
+				++c;
+			}
+			else {
+				path += *c;
+			}
+		}
+		return path;
+	}
+
+	//  what Instruction::getOpcodeName returns for each opcode
+	const struct {
+		unsigned Opcode;
+		const char* Name;
+	} OpcodeNames[] = {
+		{ Opcode::Ret, "ret" }, { Opcode::Br, "br" }, { Opcode::Switch, "switch" },
+		{ Opcode::IndirectBr, "indirectbr" }, { Opcode::Invoke, "invoke" },
+		{ Opcode::Resume, "resume" }, { Opcode::Unreachable, "unreachable" },
+		{ Opcode::CleanupRet, "cleanupret" }, { Opcode::CatchRet, "catchret" },
+		{ Opcode::CatchSwitch, "catchswitch" },
+		{ Opcode::Add, "add" }, { Opcode::FAdd, "fadd" }, { Opcode::Sub, "sub" },
+		{ Opcode::FSub, "fsub" }, { Opcode::Mul, "mul" }, { Opcode::FMul, "fmul" },
+		{ Opcode::UDiv, "udiv" }, { Opcode::SDiv, "sdiv" }, { Opcode::FDiv, "fdiv" },
+		{ Opcode::URem, "urem" }, { Opcode::SRem, "srem" }, { Opcode::FRem, "frem" },
+		{ Opcode::Shl, "shl" }, { Opcode::LShr, "lshr" }, { Opcode::AShr, "ashr" },
+		{ Opcode::And, "and" }, { Opcode::Or, "or" }, { Opcode::Xor, "xor" },
+		{ Opcode::Alloca, "alloca" }, { Opcode::Load, "load" }, { Opcode::Store, "store" },
+		{ Opcode::GetElementPtr, "getelementptr" }, { Opcode::Fence, "fence" },
+		{ Opcode::AtomicCmpXchg, "cmpxchg" }, { Opcode::AtomicRMW, "atomicrmw" },
+		{ Opcode::Trunc, "trunc" }, { Opcode::ZExt, "zext" }, { Opcode::SExt, "sext" },
+		{ Opcode::FPToUI, "fptoui" }, { Opcode::FPToSI, "fptosi" },
+		{ Opcode::UIToFP, "uitofp" }, { Opcode::SIToFP, "sitofp" },
+		{ Opcode::FPTrunc, "fptrunc" }, { Opcode::FPExt, "fpext" },
+		{ Opcode::PtrToInt, "ptrtoint" }, { Opcode::IntToPtr, "inttoptr" },
+		{ Opcode::BitCast, "bitcast" }, { Opcode::AddrSpaceCast, "addrspacecast" },
+		{ Opcode::CleanupPad, "cleanuppad" }, { Opcode::CatchPad, "catchpad" },
+		{ Opcode::ICmp, "icmp" }, { Opcode::FCmp, "fcmp" }, { Opcode::PHI, "phi" },
+		{ Opcode::Call, "call" }, { Opcode::Select, "select" }, { Opcode::VAArg, "va_arg" },
+		{ Opcode::ExtractElement, "extractelement" }, { Opcode::InsertElement, "insertelement" },
+		{ Opcode::ShuffleVector, "shufflevector" }, { Opcode::ExtractValue, "extractvalue" },
+		{ Opcode::InsertValue, "insertvalue" }, { Opcode::LandingPad, "landingpad" },
+	};
+
+	const char* getOpcodeName(unsigned opcode) {
+		for (auto& entry : OpcodeNames) {
+			if (entry.Opcode == opcode) {
+				return entry.Name;
+			}
+		}
+		return "<Invalid operator> ";
+	}
+}
+
+Registry::Registry() {
+	std::string path = getOutputPath("CSE231_PROFILE", "cse231.%p.profraw");
+	TextMode = path == "-";
+	if (!TextMode) {
+		FD = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		void* base = FD < 0 ? MAP_FAILED : mmap(nullptr, ReservedSize, PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+		if (base != MAP_FAILED && ftruncate(FD, sysconf(_SC_PAGESIZE)) == 0) {
+			Base = static_cast<char*>(base);
+			FileSize = sysconf(_SC_PAGESIZE);
+			ProfileHeader* header = reinterpret_cast<ProfileHeader*>(Base);
+			memcpy(header->Magic, ProfileMagic, sizeof(ProfileMagic));
+			header->Version = ProfileVersion;
+			header->NumRecords = 0;
+			header->Size = sizeof(ProfileHeader);
+		}
+		else {
+			fprintf(stderr, "cse231: cannot map profile %s, the counts are lost\n", path.c_str());
+		}
+	}
+
+	std::vector<std::string> opcodeNames;
+	for (unsigned i = 0; i < Opcode::OtherOpsEnd; ++i) {
+		opcodeNames.push_back(getOpcodeName(i));
+	}
+	Instrs = allocateCounters(OpcodeRecord, opcodeNames, Opcode::OtherOpsEnd);
+	Branches = allocateCounters(BranchRecord, std::vector<std::string>(), 2);
+}
+
+//  zeroed counters in a new record of the profile, or on the heap without one
+uint64_t* Registry::allocateCounters(RecordKind kind, const std::vector<std::string>& names, uint32_t numCounters) {
+	RecordHeader record{ kind, numCounters, 0 };
+	for (const std::string& name : names) {
+		record.NamesSize += name.size() + 1;
+	}
+	if (Base) {
+		ProfileHeader* header = reinterpret_cast<ProfileHeader*>(Base);
+		uint64_t offset = header->Size;
+		uint64_t end = offset + getRecordSize(record);
+		uint64_t pageSize = sysconf(_SC_PAGESIZE);
+		uint64_t fileSize = (end + pageSize - 1) / pageSize * pageSize;
+		if (end <= ReservedSize && (fileSize <= FileSize || ftruncate(FD, fileSize) == 0)) {
+			FileSize = std::max(FileSize, fileSize);
+			char* data = Base + offset;
+			memcpy(data, &record, sizeof(RecordHeader));
+			data += sizeof(RecordHeader);
+			for (const std::string& name : names) {
+				memcpy(data, name.c_str(), name.size() + 1);
+				data += name.size() + 1;
+			}
+			++header->NumRecords;
+			header->Size = end;
+			return reinterpret_cast<uint64_t*>(Base + offset + sizeof(RecordHeader) + alignRecordSize(record.NamesSize));
+		}
+		fprintf(stderr, "cse231: the profile is full, some counts are lost\n");
+	}
+	return new uint64_t[numCounters]();
+}
+
+void Registry::flush(Shard& shard) {
+	for (unsigned i = 0; i < Opcode::OtherOpsEnd; ++i) {
+		uint64_t count = shard.Instrs[i].load(std::memory_order_relaxed);
+		Instrs[i] += count - shard.FlushedInstrs[i];
+		shard.FlushedInstrs[i] = count;
+	}
+	uint64_t taken = shard.Taken.load(std::memory_order_relaxed);
+	uint64_t total = shard.Total.load(std::memory_order_relaxed);
+	Branches[0] += taken - shard.FlushedTaken;
+	Branches[1] += total - shard.FlushedTotal;
+	shard.FlushedTaken = taken;
+	shard.FlushedTotal = total;
+}
+
+void Registry::flushAll() {
+	for (Shard* shard : Live) {
+		flush(*shard);
+	}
+}
+
+Shard::Shard() : Taken(0), Total(0), FlushedTaken(0), FlushedTotal(0) {
+	for (unsigned i = 0; i < Opcode::OtherOpsEnd; ++i) {
+		Instrs[i].store(0, std::memory_order_relaxed);
+		FlushedInstrs[i] = 0;
+	}
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.Live.push_back(this);
+	LocalShardState = ShardLive;
+}
+
+Shard::~Shard() {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.flush(*this);
+	for (auto iter = registry.Live.begin(); iter != registry.Live.end(); ++iter) {
+		if (*iter == this) {
+			registry.Live.erase(iter);
+			break;
+		}
+	}
+	LocalShardState = ShardRetired;
+}
+
+void updateInstrInfo(unsigned num, uint32_t* keys, uint64_t* values) {
+	if (Shard* shard = getLocalShard()) {
+		for (unsigned i = 0; i < num; ++i) {
+			shard->add(shard->Instrs[keys[i]], values[i]);
+		}
+		return;
+	}
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	for (unsigned i = 0; i < num; ++i) {
+		registry.Instrs[keys[i]] += values[i];
+	}
+}
+
+static void printInstrs(FILE* file, const uint64_t* instrs) {
+	for (unsigned i = 0; i < Opcode::OtherOpsEnd; ++i) {
+		if (instrs[i]) {
+			fprintf(file, "%s\t%" PRIu64 "\n", getOpcodeName(i), instrs[i]);
+		}
+	}
+}
+
+void printOutInstrInfo() {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.flushAll();
+	printInstrs(stderr, registry.Instrs);
+}
+
+void updateBranchInfo(bool taken) {
+	if (Shard* shard = getLocalShard()) {
+		shard->add(shard->Taken, taken);
+		shard->add(shard->Total, 1);
+		return;
+	}
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.Branches[0] += taken;
+	registry.Branches[1] += 1;
+}
+
+void updateSampledBranchInfo(bool taken, uint32_t period) {
+	if (Shard* shard = getLocalShard()) {
+		shard->add(shard->Taken, taken ? period : 0);
+		shard->add(shard->Total, period);
+		return;
+	}
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.Branches[0] += taken ? period : 0;
+	registry.Branches[1] += period;
+}
+
+void printOutBranchInfo() {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.flushAll();
+	fprintf(stderr, "taken\t%" PRIu64 "\n", registry.Branches[0]);
+	fprintf(stderr, "total\t%" PRIu64 "\n", registry.Branches[1]);
+}
+
+uint64_t* registerBranchSites(unsigned num, const char** names) {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	CounterTable sites;
+	sites.Names.assign(names, names + num);
+	sites.Counters = registry.allocateCounters(SiteRecord, sites.Names, 2 * num);
+	registry.Sites.push_back(sites);
+	return sites.Counters;
+}
+
+uint64_t* registerBlocks(unsigned num, const char** names) {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	CounterTable blocks;
+	blocks.Names.assign(names, names + num);
+	blocks.Counters = registry.allocateCounters(BlockRecord, blocks.Names, num);
+	registry.Blocks.push_back(blocks);
+	return blocks.Counters;
+}
+
+void addBlockHistograms(unsigned num, const uint64_t* counts, const uint32_t* index, const uint32_t* histograms) {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	for (unsigned i = 0; i < num; ++i) {
+		if (!counts[i]) {
+			continue;
+		}
+		const uint32_t* histogram = histograms + index[i];
+		for (uint32_t k = 0; k < histogram[0]; ++k) {
+			registry.Instrs[histogram[1 + 2 * k]] += counts[i] * histogram[2 + 2 * k];
+		}
+	}
+}
+
+uint64_t* registerFunctions(unsigned num, const char** names) {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	CounterTable functions;
+	functions.Names.assign(names, names + num);
+	functions.Counters = registry.allocateCounters(FunctionRecord, functions.Names, 3 * num);
+	registry.Functions.push_back(functions);
+	return functions.Counters;
+}
+
+void enterFunction(uint64_t* counters, uint32_t* depth) {
+	if (ShadowDepth == MaxShadowFrames) {
+		++ShadowOverflow;
+		return;
+	}
+	++*depth;
+	ShadowStack[ShadowDepth++] = ShadowFrame{ counters, depth, readCycleCounter(), 0 };
+}
+
+void exitFunction(uint64_t* counters) {
+	if (ShadowOverflow) {
+		--ShadowOverflow;
+		return;
+	}
+	bool onStack = false;
+	for (unsigned i = ShadowDepth; i > 0 && !onStack; --i) {
+		onStack = ShadowStack[i - 1].Counters == counters;
+	}
+	if (!onStack) {
+		return;
+	}
+
+	uint64_t now = readCycleCounter();
+	for (bool done = false; !done; ) {
+		ShadowFrame& frame = ShadowStack[--ShadowDepth];
+		done = frame.Counters == counters;
+		uint64_t cycles = now - frame.Start;
+		//  the counters are shared by all threads
+		if (--*frame.Depth == 0) {
+			__atomic_fetch_add(frame.Counters + 1, cycles, __ATOMIC_RELAXED);
+		}
+		__atomic_fetch_add(frame.Counters + 2, cycles - std::min(cycles, frame.Callees), __ATOMIC_RELAXED);
+		if (ShadowDepth) {
+			ShadowStack[ShadowDepth - 1].Callees += cycles;
+		}
+	}
+}
+
+Tracer::Tracer() {
+	std::string path = getOutputPath("CSE231_TRACE", "cse231.%p.trace");
+	FD = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	TraceHeader header;
+	memcpy(header.Magic, TraceMagic, sizeof(TraceMagic));
+	header.Version = TraceVersion;
+	header.Reserved = 0;
+	if (FD < 0 || ::write(FD, &header, sizeof(TraceHeader)) != sizeof(TraceHeader)) {
+		fprintf(stderr, "cse231: cannot write trace %s, the accesses are lost\n", path.c_str());
+		if (FD >= 0) {
+			close(FD);
+		}
+		FD = -1;
+	}
+}
+
+//  called with Lock held
+void Tracer::write(TraceBlockKind kind, uint32_t id, const void* payload, uint64_t size) {
+	if (FD < 0) {
+		return;
+	}
+	static const char padding[8] = {};
+	TraceBlockHeader block{ kind, id, size };
+	const char* parts[] = { reinterpret_cast<const char*>(&block), static_cast<const char*>(payload), padding };
+	uint64_t sizes[] = { sizeof(TraceBlockHeader), size, alignTraceSize(size) - size };
+	for (unsigned i = 0; i < 3; ++i) {
+		for (uint64_t written = 0; written < sizes[i]; ) {
+			ssize_t n = ::write(FD, parts[i] + written, sizes[i] - written);
+			if (n <= 0) {
+				fprintf(stderr, "cse231: cannot write the trace, the accesses are lost\n");
+				close(FD);
+				FD = -1;
+				return;
+			}
+			written += n;
+		}
+	}
+}
+
+uint32_t registerTraceSites(unsigned num, const char** names) {
+	Tracer& tracer = getTracer();
+	std::lock_guard<std::mutex> guard(tracer.Lock);
+	std::string payload;
+	for (unsigned i = 0; i < num; ++i) {
+		payload.append(names[i]);
+		payload.push_back('\0');
+	}
+	uint32_t firstSite = tracer.NumSites;
+	tracer.NumSites += num;
+	tracer.write(TraceSiteBlock, firstSite, payload.data(), payload.size());
+	return firstSite;
+}
+
+void traceAccess(const void* address, uint32_t site, uint32_t size, bool isStore) {
+	if (TraceBuffered == TraceBufferSize) {
+		flushTraceBuffer();
+	}
+	else if (!TraceFlusherLive) {
+		TraceFlusherLive = true;
+		LocalTraceFlusher.Live = true;
+	}
+	TraceBuffer[TraceBuffered++] = TraceAccess{ reinterpret_cast<uint64_t>(address), site, uint16_t(size), uint16_t(isStore ? TraceStore : 0) };
+}
+
+void flushTrace() {
+	flushTraceBuffer();
+}
+
+void countPath(uint64_t* table, uint32_t capacity, uint64_t path, uint32_t weight) {
+	//  open addressing with linear probing; a slot is claimed by CAS on its key
+	uint64_t key = path + 1;
+	uint64_t slot = (key * 0x9E3779B97F4A7C15ull) % capacity;
+	for (uint32_t probe = 0; probe < capacity; ++probe) {
+		uint64_t* entry = table + 2 * slot;
+		uint64_t found = __atomic_load_n(entry, __ATOMIC_RELAXED);
+		if (found == 0) {
+			__atomic_compare_exchange_n(entry, &found, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			//  found is now whatever is in the slot: 0 if this thread claimed it
+			if (found == 0) {
+				found = key;
+			}
+		}
+		if (found == key) {
+			__atomic_fetch_add(entry + 1, weight, __ATOMIC_RELAXED);
+			return;
+		}
+		slot = slot + 1 == capacity ? 0 : slot + 1;
+	}
+	__atomic_fetch_add(table + 2 * uint64_t(capacity), weight, __ATOMIC_RELAXED);
+}
+
+uint64_t* registerPaths(const char* function, uint32_t numPaths, uint32_t capacity) {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	PathTable paths;
+	paths.Kind = capacity ? PathTableRecord : PathArrayRecord;
+	paths.Function = function;
+	paths.NumCounters = capacity ? 2 * capacity + 1 : numPaths;
+	paths.Counters = registry.allocateCounters(paths.Kind, std::vector<std::string>{ paths.Function }, paths.NumCounters);
+	registry.Paths.push_back(paths);
+	return paths.Counters;
+}
+
+uint32_t getSampleCountdown(uint32_t period) {
+	//  xorshift64, seeded differently in every thread
+	thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) | 1;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	if (period <= 1) {
+		return 1;
+	}
+	return 1 + state % (2 * uint64_t(period) - 1);
+}
+
+void writeProfile() {
+	Registry& registry = getRegistry();
+	std::lock_guard<std::mutex> guard(registry.Lock);
+	registry.flushAll();
+	if (!registry.TextMode) {
+		return;
+	}
+
+	fprintf(stderr, "# instructions\n");
+	printInstrs(stderr, registry.Instrs);
+	fprintf(stderr, "# branches\n");
+	fprintf(stderr, "taken\t%" PRIu64 "\n", registry.Branches[0]);
+	fprintf(stderr, "total\t%" PRIu64 "\n", registry.Branches[1]);
+	fprintf(stderr, "# sites\n");
+	fprintf(stderr, "function\tblock\tlocation\ttaken\ttotal\n");
+	for (const CounterTable& sites : registry.Sites) {
+		for (unsigned i = 0; i < sites.Names.size(); ++i) {
+			uint64_t taken = sites.Counters[2 * i];
+			fprintf(stderr, "%s\t%" PRIu64 "\t%" PRIu64 "\n", sites.Names[i].c_str(), taken, taken + sites.Counters[2 * i + 1]);
+		}
+	}
+	fprintf(stderr, "# blocks\n");
+	fprintf(stderr, "function\tblock\tcount\n");
+	for (const CounterTable& blocks : registry.Blocks) {
+		for (unsigned i = 0; i < blocks.Names.size(); ++i) {
+			fprintf(stderr, "%s\t%" PRIu64 "\n", blocks.Names[i].c_str(), blocks.Counters[i]);
+		}
+	}
+	//  the flat profile, by exclusive cycles
+	std::vector<std::pair<const std::string*, const uint64_t*>> functions;
+	uint64_t totalCycles = 0;
+	for (const CounterTable& table : registry.Functions) {
+		for (unsigned i = 0; i < table.Names.size(); ++i) {
+			if (table.Counters[3 * i]) {
+				functions.push_back(std::make_pair(&table.Names[i], table.Counters + 3 * i));
+				totalCycles += table.Counters[3 * i + 2];
+			}
+		}
+	}
+	std::stable_sort(functions.begin(), functions.end(), [](const std::pair<const std::string*, const uint64_t*>& a, const std::pair<const std::string*, const uint64_t*>& b) {
+		return a.second[2] != b.second[2] ? a.second[2] > b.second[2] : a.second[0] > b.second[0];
+	});
+	fprintf(stderr, "# functions\n");
+	fprintf(stderr, "function\tcalls\tinclusive\texclusive\texclusive%%\n");
+	for (auto& function : functions) {
+		const uint64_t* counters = function.second;
+		fprintf(stderr, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.2f\n", function.first->c_str(), counters[0], counters[1], counters[2],
+			totalCycles ? 100.0 * counters[2] / totalCycles : 0.0);
+	}
+	fprintf(stderr, "# paths\n");
+	fprintf(stderr, "function\tpath\tcount\n");
+	for (const PathTable& table : registry.Paths) {
+		std::vector<std::string> names;
+		std::vector<uint64_t> counts;
+		expandPathCounters(table.Kind, table.Function, table.Counters, table.NumCounters, names, counts);
+		for (unsigned i = 0; i < names.size(); ++i) {
+			fprintf(stderr, "%s\t%" PRIu64 "\n", names[i].c_str(), counts[i]);
+		}
+	}
+}
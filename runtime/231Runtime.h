@@ -0,0 +1,106 @@
+//===- 231Runtime.h - Runtime for the CSE 231 instrumentation ------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the functions the part 1 passes insert calls to
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231RUNTIME_H
+#define LLVM_TRANSFORMS_231RUNTIME_H
+
+#include <cstdint>
+
+/*
+ * The counters are sharded per thread: a thread only ever writes its own
+ * shard, so updates take no lock and no locked instruction. A shard is merged
+ * into the process totals when its thread exits; the print functions add the
+ * shards of the threads still running. The totals are cumulative and are not
+ * reset by printing.
+ *
+ * The passes don't print. The process totals and the counters the module
+ * constructors register live in the mapping of the binary profile
+ * $CSE231_PROFILE (default cse231.%p.profraw, %p being the process id; see
+ * 231Profile.h), so the counts are in the file as they are made. Every
+ * instrumented module gets a destructor that adds what is only known at exit,
+ * the opcode counts and edge-derived block counts of cse231-cdi, and calls
+ * writeProfile().
+ * cse231-profdata merges and prints profiles.
+ */
+extern "C" {
+
+//  cse231-cdi: the block executed values[i] instructions with opcode keys[i], i < num
+void updateInstrInfo(unsigned num, uint32_t* keys, uint64_t* values);
+//  print "opcode\tcount" for every opcode executed so far to stderr
+void printOutInstrInfo();
+
+//  cse231-bb: a conditional branch was executed
+void updateBranchInfo(bool taken);
+//  cse231-bb -cse231-sample-period: a sampled conditional branch was executed,
+//  standing for period executions
+void updateSampledBranchInfo(bool taken, uint32_t period);
+//  print "taken\tcount" and "total\tcount" to stderr
+void printOutBranchInfo();
+
+//  cse231-bb -bb-site-counters: names[i] is "function\tblock\tlocation". returns
+//  the zeroed counters the module is to use, taken and not taken for site i at
+//  2 * i and 2 * i + 1
+uint64_t* registerBranchSites(unsigned num, const char** names);
+
+//  cse231-cdi -cdi-inline-counters, -cdi-edge-counters: returns the zeroed counters
+//  the module is to use, the number of executions of block names[i],
+//  "function\tblock", at i
+uint64_t* registerBlocks(unsigned num, const char** names);
+
+//  cse231-cdi -cdi-inline-counters, -cdi-edge-counters: block i ran counts[i]
+//  times and executes the opcode histogram at histograms + index[i] each time: its
+//  length n followed by n (opcode, count) pairs
+void addBlockHistograms(unsigned num, const uint64_t* counts, const uint32_t* index, const uint32_t* histograms);
+
+//  cse231-paths: path ran, standing for weight executions, in a function with too
+//  many paths for an array of counters. table holds capacity (path + 1, count) pairs
+//  and a counter of the paths that found it full
+void countPath(uint64_t* table, uint32_t capacity, uint64_t path, uint32_t weight);
+
+//  cse231-paths: returns the zeroed counters function is to use, an array of numPaths
+//  counters indexed by path if capacity is 0, the table of countPath otherwise
+uint64_t* registerPaths(const char* function, uint32_t numPaths, uint32_t capacity);
+
+//  cse231-func: returns the zeroed counters the module is to use, calls, inclusive
+//  and exclusive cycles of function names[i] at 3 * i, 3 * i + 1 and 3 * i + 2
+uint64_t* registerFunctions(unsigned num, const char** names);
+
+//  cse231-func -func-timing: the function with these counters was entered. depth is
+//  the number of its activations on this thread's stack; only the outermost one
+//  adds to the inclusive cycles
+void enterFunction(uint64_t* counters, uint32_t* depth);
+//  the function with these counters returns. activations above it that were
+//  unwound by an exception or longjmp end here as well
+void exitFunction(uint64_t* counters);
+
+//  cse231-memtrace: names[i] is "function\tblock\tlocation\taccess". returns the
+//  trace's id of site 0 of the module; the module's sites follow it
+uint32_t registerTraceSites(unsigned num, const char** names);
+//  cse231-memtrace: append an access of size bytes at address to this thread's
+//  buffer, which goes to the trace $CSE231_TRACE (default cse231.%p.trace, see
+//  231Trace.h) when it is full or the thread exits
+void traceAccess(const void* address, uint32_t site, uint32_t size, bool isStore);
+//  cse231-memtrace: write out this thread's buffer; the module destructors call it
+void flushTrace();
+
+//  -cse231-sample-period: the number of calls until the next sample of this
+//  thread, uniform in [1, 2 * period - 1]
+uint32_t getSampleCountdown(uint32_t period);
+
+//  add the counts of the threads still running to the profile;
+//  with CSE231_PROFILE=- print it to stderr as text instead
+void writeProfile();
+
+}
+
+#endif
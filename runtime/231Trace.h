@@ -0,0 +1,149 @@
+//===- 231Trace.h - Memory access trace format of the CSE 231 runtime ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the layout of the memory access traces written by the
+// runtime for cse231-memtrace and read by cse231-reuse
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231TRACE_H
+#define LLVM_TRANSFORMS_231TRACE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace cse231 {
+
+/*
+ * A trace is a TraceHeader followed by blocks, all in host byte order and
+ * 8 byte aligned:
+ *
+ *   TraceBlockHeader
+ *   char     Payload[Size]
+ *
+ * A site block names the sites Id, Id + 1, ... with NUL terminated
+ * "function\tblock\tlocation\taccess" strings, padded to 8 bytes. An access
+ * block holds Size / sizeof(TraceAccess) accesses of thread Id, in program
+ * order. The runtime appends the blocks under a lock, so the blocks of the
+ * threads interleave but never mix; a block cut short by a crash ends the
+ * trace.
+ */
+static const char TraceMagic[8] = { 'C', 'S', 'E', '2', '3', '1', 'T', 'R' };
+static const uint32_t TraceVersion = 1;
+
+struct TraceHeader {
+	char Magic[8];
+	uint32_t Version;
+	uint32_t Reserved;
+};
+
+enum TraceBlockKind : uint32_t {
+	TraceSiteBlock = 1,
+	TraceAccessBlock = 2,
+};
+
+struct TraceBlockHeader {
+	uint32_t Kind;
+	//  the first site of a site block, the thread of an access block
+	uint32_t Id;
+	uint64_t Size;
+};
+
+enum TraceAccessFlags : uint16_t {
+	TraceStore = 1,
+};
+
+struct TraceAccess {
+	uint64_t Address;
+	uint32_t Site;
+	//  bytes accessed
+	uint16_t Size;
+	uint16_t Flags;
+};
+
+inline uint64_t alignTraceSize(uint64_t size) {
+	return (size + 7) & ~uint64_t(7);
+}
+
+/*
+ * Calls visitSites(uint32_t firstSite, std::vector<std::string>& names) and
+ * visitAccesses(uint32_t thread, const TraceAccess* accesses, uint64_t num)
+ * for every block of the trace in data, in file order. Returns false, with
+ * a message in error, if it isn't a trace of this version; a truncated last
+ * block is only reported in error.
+ */
+template <class SiteVisitor, class AccessVisitor>
+bool forEachTraceBlock(const char* data, uint64_t size, SiteVisitor visitSites, AccessVisitor visitAccesses, std::string& error) {
+	TraceHeader header;
+	if (size < sizeof(TraceHeader) || memcmp(data, TraceMagic, sizeof(TraceMagic)) != 0) {
+		error = "not a cse231 trace";
+		return false;
+	}
+	memcpy(&header, data, sizeof(TraceHeader));
+	if (header.Version != TraceVersion) {
+		error = "unsupported trace version";
+		return false;
+	}
+
+	std::vector<TraceAccess> accesses;
+	uint64_t offset = sizeof(TraceHeader);
+	while (offset < size) {
+		TraceBlockHeader block;
+		if (offset + sizeof(TraceBlockHeader) > size) {
+			error = "truncated block";
+			return true;
+		}
+		memcpy(&block, data + offset, sizeof(TraceBlockHeader));
+		const char* payload = data + offset + sizeof(TraceBlockHeader);
+		if (block.Size > size - offset - sizeof(TraceBlockHeader)) {
+			error = "truncated block";
+			return true;
+		}
+		offset += sizeof(TraceBlockHeader) + alignTraceSize(block.Size);
+
+		switch (block.Kind) {
+		case TraceSiteBlock: {
+			std::vector<std::string> names;
+			const char* name = payload;
+			const char* namesEnd = payload + block.Size;
+			while (name < namesEnd) {
+				const char* nameEnd = static_cast<const char*>(memchr(name, '\0', namesEnd - name));
+				if (!nameEnd) {
+					error = "malformed site names";
+					return false;
+				}
+				names.push_back(std::string(name, nameEnd));
+				name = nameEnd + 1;
+			}
+			visitSites(block.Id, names);
+			break;
+		}
+		case TraceAccessBlock:
+			if (block.Size % sizeof(TraceAccess) != 0) {
+				error = "malformed access block";
+				return false;
+			}
+			//  the payload of a mapped file needn't be aligned for TraceAccess
+			accesses.resize(block.Size / sizeof(TraceAccess));
+			memcpy(accesses.data(), payload, block.Size);
+			visitAccesses(block.Id, accesses.data(), accesses.size());
+			break;
+		default:
+			//  blocks of later versions of the runtime are skipped
+			break;
+		}
+	}
+	return true;
+}
+
+}
+
+#endif
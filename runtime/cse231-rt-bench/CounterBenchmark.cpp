@@ -0,0 +1,99 @@
+//===- CounterBenchmark.cpp - Cost of the counter update schemes ----------===//
+//
+// Every thread executes the same instrumented "block" in a loop, the way the
+// threads of a service run the same hot code. One block execution is counted
+// with each of the schemes:
+//
+//   locked   updateInstrInfo of a single-threaded runtime behind one mutex
+//   sharded  updateInstrInfo of the cse231_rt runtime (per-thread shards)
+//   atomic   -cdi-inline-counters (relaxed atomic add, the default)
+//   inline   -cdi-inline-counters -cse231-atomic-counters=false (plain add, racy
+//            with several threads)
+//
+//   cse231-rt-bench [iterations per thread]
+//
+// prints the aggregate number of block executions per microsecond for 1 to 64
+// threads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "231Runtime.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+	uint32_t Keys[] = { 2, 13, 53 };
+	uint64_t Values[] = { 1, 3, 1 };
+	const unsigned NumKeys = 3;
+
+	std::mutex LegacyLock;
+	uint64_t LegacyCounts[64];
+
+	void legacyUpdateInstrInfo(unsigned num, uint32_t* keys, uint64_t* values) {
+		std::lock_guard<std::mutex> guard(LegacyLock);
+		for (unsigned i = 0; i < num; ++i) {
+			LegacyCounts[keys[i]] += values[i];
+		}
+	}
+
+	std::atomic<uint64_t> AtomicCounter(0);
+	volatile uint64_t InlineCounter = 0;
+
+	void runLocked(unsigned long iterations) {
+		for (unsigned long i = 0; i < iterations; ++i) {
+			legacyUpdateInstrInfo(NumKeys, Keys, Values);
+		}
+	}
+
+	void runSharded(unsigned long iterations) {
+		for (unsigned long i = 0; i < iterations; ++i) {
+			updateInstrInfo(NumKeys, Keys, Values);
+		}
+	}
+
+	void runAtomic(unsigned long iterations) {
+		for (unsigned long i = 0; i < iterations; ++i) {
+			AtomicCounter.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	void runInline(unsigned long iterations) {
+		for (unsigned long i = 0; i < iterations; ++i) {
+			InlineCounter = InlineCounter + 1;
+		}
+	}
+
+	//  block executions per microsecond over all threads
+	double measure(void (*body)(unsigned long), unsigned numThreads, unsigned long iterations) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < numThreads; ++t) {
+			threads.emplace_back(body, iterations);
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		return numThreads * iterations / elapsed.count();
+	}
+}
+
+int main(int argc, char** argv) {
+	unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+	printf("threads\tlocked\tsharded\tatomic\tinline\n");
+	for (unsigned numThreads = 1; numThreads <= 64; numThreads *= 2) {
+		printf("%u\t%.1f\t%.1f\t%.1f\t%.1f\n",
+			numThreads,
+			measure(runLocked, numThreads, iterations),
+			measure(runSharded, numThreads, iterations),
+			measure(runAtomic, numThreads, iterations),
+			measure(runInline, numThreads, iterations));
+	}
+	return 0;
+}
@@ -0,0 +1,466 @@
+//===- cse231-driver.cpp - Batch driver for the CSE 231 passes ------------===//
+//
+// Runs the cse231-* plugin passes over many bitcode files in one go instead of
+// one `opt -load` invocation per module.
+//
+//   cse231-driver -load submission_pt3.so -passes=cse231-liveness -j 8 \
+//                 -input-list=nightly.txt -o results.txt
+//
+// The input files are split into contiguous chunks, one per worker process.
+// Every worker loads its modules lazily, materializes only the function bodies
+// selected by -functions, and writes the pass output for its chunk to a
+// temporary file. The parent concatenates the chunks in input order.
+// Workers get the whole command line apart from the inputs, -j and -o, so
+// plugin options such as -csi-format or -dfa-checkpoint-interval reach them.
+//
+// doInitialization() runs after the selected bodies are materialized; the
+// functions -functions leaves out have no body then. With -output-suffix,
+// every module is materialized in full and written next to its input after
+// the passes have run, e.g. foo.bc -> foo.bc.opt.bc for -output-suffix=.opt.bc.
+//
+// The process-wide "total" records cse231-csi prints at exit in
+// -csi-format=json and csv are added up over the workers into one.
+//
+// Workers are processes rather than threads because the passes print straight
+// to errs() and keep per-module state in globals.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/PassInfo.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PluginLoader.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFiles(
+	cl::Positional,
+	cl::desc("<bitcode files>"),
+	cl::ZeroOrMore);
+
+static cl::opt<std::string> InputList(
+	"input-list",
+	cl::desc("File with one bitcode path per line"),
+	cl::value_desc("filename"));
+
+static cl::list<std::string> PassNames(
+	"passes",
+	cl::desc("Comma separated list of passes to run, e.g. cse231-csi,cse231-liveness"),
+	cl::CommaSeparated,
+	cl::OneOrMore);
+
+static cl::opt<std::string> FunctionFilter(
+	"functions",
+	cl::desc("Only materialize and run on functions whose name matches this regex"),
+	cl::value_desc("regex"));
+
+static cl::opt<unsigned> Jobs(
+	"j",
+	cl::desc("Number of worker processes (default: number of cores)"),
+	cl::init(0));
+
+static cl::opt<std::string> OutputFilename(
+	"o",
+	cl::desc("Consolidated output file"),
+	cl::value_desc("filename"),
+	cl::init("-"));
+
+static cl::opt<std::string> OutputSuffix(
+	"output-suffix",
+	cl::desc("Write every module after the passes to its input path with this suffix appended"),
+	cl::value_desc("suffix"));
+
+//  set by the parent when it spawns a worker; the worker reads its chunk from this file.
+static cl::opt<std::string> WorkerList(
+	"worker-list",
+	cl::Hidden);
+
+static bool readLines(StringRef path, std::vector<std::string>& lines) {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFileOrSTDIN(path);
+	if (!buffer) {
+		errs() << "cse231-driver: cannot read '" << path << "': " << buffer.getError().message() << '\n';
+		return false;
+	}
+	SmallVector<StringRef, 64> split;
+	(*buffer)->getBuffer().split(split, '\n', -1, false);
+	for (StringRef line : split) {
+		line = line.trim();
+		if (!line.empty() && !line.startswith("#")) {
+			lines.push_back(line.str());
+		}
+	}
+	return true;
+}
+
+/*
+ * Build the pass pipelines for one module.
+ * Function passes go into FPM and are run per function so that only the
+ * selected bodies have to be materialized. Module passes force the whole
+ * module to be materialized.
+ */
+static bool addPasses(legacy::FunctionPassManager& FPM, legacy::PassManager& MPM, bool& hasModulePass) {
+	PassRegistry* registry = PassRegistry::getPassRegistry();
+	for (const std::string& name : PassNames) {
+		const PassInfo* info = registry->getPassInfo(name);
+		if (!info || !info->getNormalCtor()) {
+			errs() << "cse231-driver: unknown pass '" << name << "' (missing -load?)\n";
+			return false;
+		}
+		Pass* pass = info->createPass();
+		switch (pass->getPassKind()) {
+		case PT_Function:
+			FPM.add(pass);
+			break;
+		case PT_Module:
+			MPM.add(pass);
+			hasModulePass = true;
+			break;
+		default:
+			errs() << "cse231-driver: pass '" << name << "' is neither a function nor a module pass\n";
+			delete pass;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool processFile(const std::string& path, const Regex* filter) {
+	//  a fresh context per file so that memory is released between modules
+	LLVMContext ctx;
+	SMDiagnostic err;
+
+	errs() << "; cse231-driver: " << path << '\n';
+	std::unique_ptr<Module> module = getLazyIRFileModule(path, err, ctx);
+	if (!module) {
+		err.print("cse231-driver", errs());
+		return false;
+	}
+
+	legacy::FunctionPassManager FPM(module.get());
+	legacy::PassManager MPM;
+	bool hasModulePass = false;
+	if (!addPasses(FPM, MPM, hasModulePass)) {
+		return false;
+	}
+
+	if (hasModulePass || !OutputSuffix.empty()) {
+		if (Error e = module->materializeAll()) {
+			errs() << "cse231-driver: " << path << ": " << toString(std::move(e)) << '\n';
+			return false;
+		}
+	}
+
+	//  the selected bodies are materialized before doInitialization(), which may scan them
+	std::unordered_set<Function*> skipped;
+	for (Function& func : *module) {
+		if (func.isDeclaration()) {
+			continue;
+		}
+		if (filter && !filter->match(func.getName())) {
+			skipped.insert(&func);
+			continue;
+		}
+		if (Error e = func.materialize()) {
+			errs() << "cse231-driver: " << path << ": " << toString(std::move(e)) << '\n';
+			return false;
+		}
+	}
+
+	//  like opt, the function passes also run on the functions doInitialization() adds
+	FPM.doInitialization();
+	for (Function& func : *module) {
+		if (!func.isDeclaration() && !skipped.count(&func)) {
+			FPM.run(func);
+		}
+	}
+	FPM.doFinalization();
+
+	if (hasModulePass) {
+		MPM.run(*module);
+	}
+
+	if (!OutputSuffix.empty()) {
+		std::error_code ec;
+		ToolOutputFile out(path + OutputSuffix, ec, sys::fs::F_None);
+		if (ec) {
+			errs() << "cse231-driver: " << path << OutputSuffix << ": " << ec.message() << '\n';
+			return false;
+		}
+		WriteBitcodeToFile(*module, out.os());
+		out.keep();
+	}
+	return true;
+}
+
+static int runWorker() {
+	std::vector<std::string> files;
+	if (!readLines(WorkerList, files)) {
+		return 1;
+	}
+
+	std::unique_ptr<Regex> filter;
+	if (!FunctionFilter.empty()) {
+		filter.reset(new Regex(FunctionFilter));
+		std::string error;
+		if (!filter->isValid(error)) {
+			errs() << "cse231-driver: invalid -functions regex: " << error << '\n';
+			return 1;
+		}
+	}
+
+	bool ok = true;
+	for (const std::string& path : files) {
+		ok &= processFile(path, filter.get());
+	}
+	return ok ? 0 : 1;
+}
+
+/*
+ * The process-wide totals cse231-csi prints at exit in -csi-format=json and
+ * csv, one per worker. They are held back from the output and added up, and
+ * so are the CSV headers after the first.
+ */
+struct CSITotals {
+	bool SeenCSVHeader = false;
+	unsigned NumJSON = 0, NumCSV = 0;
+	int64_t Modules = 0, Instructions = 0;
+	//  in the order they first appear
+	typedef MapVector<std::string, int64_t, std::map<std::string, unsigned>> OpcodeCounts;
+	OpcodeCounts JSONOpcodes, CSVOpcodes;
+
+	//  whether line is held back: one of the totals, which is added, or a repeated header
+	bool add(StringRef line) {
+		if (line == "scope,module,function,opcode,count") {
+			bool repeated = SeenCSVHeader;
+			SeenCSVHeader = true;
+			return repeated;
+		}
+		if (line.startswith("total,,,")) {
+			std::pair<StringRef, StringRef> opcodeCount = line.drop_front(strlen("total,,,")).split(',');
+			int64_t count;
+			if (opcodeCount.second.getAsInteger(10, count)) {
+				return false;
+			}
+			CSVOpcodes[opcodeCount.first.str()] += count;
+			++NumCSV;
+			return true;
+		}
+		if (!line.startswith("{\"total\":")) {
+			return false;
+		}
+		Expected<json::Value> value = json::parse(line);
+		if (!value) {
+			consumeError(value.takeError());
+			return false;
+		}
+		json::Object* total = value->getAsObject() ? value->getAsObject()->getObject("total") : nullptr;
+		json::Object* opcodes = total ? total->getObject("opcodes") : nullptr;
+		if (!opcodes) {
+			return false;
+		}
+		Modules += total->getInteger("modules").getValueOr(0);
+		Instructions += total->getInteger("instructions").getValueOr(0);
+		for (const auto& opcode : *opcodes) {
+			JSONOpcodes[opcode.first.str()] += opcode.second.getAsInteger().getValueOr(0);
+		}
+		++NumJSON;
+		return true;
+	}
+
+	void print(raw_ostream& os) const {
+		if (NumJSON) {
+			json::Object opcodes;
+			for (const auto& opcode : JSONOpcodes) {
+				opcodes[opcode.first] = opcode.second;
+			}
+			json::Object total{
+				{ "modules", Modules },
+				{ "instructions", Instructions },
+				{ "opcodes", std::move(opcodes) }
+			};
+			os << json::Value(json::Object{ { "total", std::move(total) } }) << '\n';
+		}
+		if (NumCSV) {
+			for (const auto& opcode : CSVOpcodes) {
+				os << "total,,," << opcode.first << ',' << opcode.second << '\n';
+			}
+		}
+	}
+};
+
+//  copies the output of a worker, apart from the totals
+static void copyChunk(StringRef chunk, raw_ostream& os, CSITotals& totals) {
+	while (!chunk.empty()) {
+		std::pair<StringRef, StringRef> line = chunk.split('\n');
+		if (!totals.add(line.first)) {
+			os << line.first;
+			if (line.first.size() < chunk.size()) {
+				os << '\n';
+			}
+		}
+		chunk = line.second;
+	}
+}
+
+/*
+ * Whether the occurrence of option recorded at args[position] is a single
+ * argument like "-j=8". cl records the position of the value, so for "-j 8"
+ * it is the "8", and the option name is the argument before it.
+ */
+static bool isJoinedOption(const cl::Option& option, const char* arg) {
+	StringRef name(arg);
+	return name.startswith("-") && name.ltrim('-').startswith((option.ArgStr + "=").str());
+}
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+
+	//  what opt initializes, so that the passes can require analyses
+	PassRegistry& registry = *PassRegistry::getPassRegistry();
+	initializeCore(registry);
+	initializeAnalysis(registry);
+	initializeTransformUtils(registry);
+	initializeScalarOpts(registry);
+
+	//  response files are expanded here, so that the positions cl records index args
+	BumpPtrAllocator allocator;
+	StringSaver saver(allocator);
+	SmallVector<const char*, 64> args(argv, argv + argc);
+	cl::ExpandResponseFiles(saver, cl::TokenizeGNUCommandLine, args);
+	cl::ParseCommandLineOptions(args.size(), args.data(), "CSE 231 batch analysis driver\n");
+
+	if (!WorkerList.empty()) {
+		return runWorker();
+	}
+
+	std::vector<std::string> files(InputFiles.begin(), InputFiles.end());
+	if (!InputList.empty() && !readLines(InputList, files)) {
+		return 1;
+	}
+	if (files.empty()) {
+		errs() << "cse231-driver: no input files\n";
+		return 1;
+	}
+
+	unsigned numWorkers = Jobs ? Jobs : hardware_concurrency();
+	numWorkers = std::max(1u, std::min<unsigned>(numWorkers, files.size()));
+
+	std::string program = sys::fs::getMainExecutable(argv[0], (void*)(intptr_t)main);
+
+	//  the arguments every worker shares, apart from its own -worker-list: all but the inputs, -j and -o
+	std::unordered_set<unsigned> parentArgs;
+	for (unsigned i = 0; i < InputFiles.size(); ++i) {
+		parentArgs.insert(InputFiles.getPosition(i));
+	}
+	for (cl::Option* option : { (cl::Option*)&InputList, (cl::Option*)&Jobs, (cl::Option*)&OutputFilename }) {
+		if (option->getNumOccurrences()) {
+			unsigned position = option->getPosition();
+			parentArgs.insert(position);
+			if (!isJoinedOption(*option, args[position])) {
+				parentArgs.insert(position - 1);
+			}
+		}
+	}
+	std::vector<StringRef> commonArgs;
+	for (unsigned i = 1; i < args.size(); ++i) {
+		if (!parentArgs.count(i)) {
+			commonArgs.push_back(args[i]);
+		}
+	}
+
+	struct Worker {
+		SmallString<128> listFile;
+		SmallString<128> outputFile;
+		sys::ProcessInfo process;
+	};
+	std::vector<Worker> workers(numWorkers);
+
+	bool ok = true;
+	for (unsigned w = 0; w < numWorkers; ++w) {
+		Worker& worker = workers[w];
+		int listFD;
+		if (sys::fs::createTemporaryFile("cse231-driver-list", "txt", listFD, worker.listFile) ||
+			sys::fs::createTemporaryFile("cse231-driver-out", "txt", worker.outputFile)) {
+			errs() << "cse231-driver: cannot create temporary files\n";
+			return 1;
+		}
+		{
+			raw_fd_ostream listOS(listFD, true);
+			std::size_t begin = files.size() * w / numWorkers;
+			std::size_t end = files.size() * (w + 1) / numWorkers;
+			for (std::size_t i = begin; i < end; ++i) {
+				listOS << files[i] << '\n';
+			}
+		}
+
+		std::string workerListArg = "-worker-list=" + worker.listFile.str().str();
+		std::vector<StringRef> workerArgs{ program };
+		for (StringRef arg : commonArgs) {
+			workerArgs.push_back(arg);
+		}
+		workerArgs.push_back(workerListArg);
+
+		//  stdin untouched, stdout and stderr both go to the chunk output
+		Optional<StringRef> redirects[] = { None, StringRef(worker.outputFile), StringRef(worker.outputFile) };
+		std::string errMsg;
+		worker.process = sys::ExecuteNoWait(program, workerArgs, None, redirects, 0, &errMsg);
+		if (worker.process.Pid == 0) {
+			errs() << "cse231-driver: cannot start worker: " << errMsg << '\n';
+			ok = false;
+		}
+	}
+
+	for (Worker& worker : workers) {
+		if (worker.process.Pid == 0) {
+			continue;
+		}
+		std::string errMsg;
+		sys::ProcessInfo result = sys::Wait(worker.process, 0, true, &errMsg);
+		if (result.ReturnCode != 0) {
+			ok = false;
+		}
+	}
+
+	std::error_code ec;
+	ToolOutputFile out(OutputFilename, ec, sys::fs::F_None);
+	if (ec) {
+		errs() << "cse231-driver: " << ec.message() << '\n';
+		return 1;
+	}
+	CSITotals totals;
+	for (Worker& worker : workers) {
+		if (ErrorOr<std::unique_ptr<MemoryBuffer>> chunk = MemoryBuffer::getFile(worker.outputFile)) {
+			copyChunk((*chunk)->getBuffer(), out.os(), totals);
+		}
+		sys::fs::remove(worker.listFile);
+		sys::fs::remove(worker.outputFile);
+	}
+	totals.print(out.os());
+	out.keep();
+
+	return ok ? 0 : 1;
+}
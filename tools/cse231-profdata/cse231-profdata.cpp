@@ -0,0 +1,327 @@
+//===- cse231-profdata.cpp - Merge and show CSE 231 profiles --------------===//
+//
+// Works on the binary profiles written by the cse231_rt runtime (231Profile.h).
+//
+//   cse231-profdata merge -j 16 -o job.profdata run/*.profraw
+//   cse231-profdata show job.profdata
+//
+// merge sums any number of profiles, including merged ones, into one. The
+// inputs are split into contiguous chunks that are read and summed by
+// separate threads; the partial sums are then added in input order, so the
+// output doesn't depend on -j. Opcodes are matched by name and branch sites
+// by "function\tblock\tlocation".
+//
+// show prints the opcode histogram, the branch totals, the branch-bias table,
+// the block counts, the flat function profile and the path counts in the text
+// format of CSE231_PROFILE=-.
+//
+//===----------------------------------------------------------------------===//
+
+#include "231Profile.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+using namespace cse231;
+
+static cl::SubCommand MergeCommand("merge", "Sum profiles into one");
+static cl::SubCommand ShowCommand("show", "Print the sum of profiles as text");
+
+static cl::list<std::string> InputFiles(
+	cl::Positional,
+	cl::desc("<profiles>"),
+	cl::OneOrMore,
+	cl::sub(MergeCommand),
+	cl::sub(ShowCommand));
+
+static cl::opt<std::string> OutputFilename(
+	"o",
+	cl::desc("Output file"),
+	cl::value_desc("filename"),
+	cl::init("-"),
+	cl::sub(MergeCommand),
+	cl::sub(ShowCommand));
+
+static cl::opt<unsigned> Jobs(
+	"j",
+	cl::desc("Number of threads reading the inputs (default: number of cores)"),
+	cl::init(0),
+	cl::sub(MergeCommand),
+	cl::sub(ShowCommand));
+
+namespace {
+	struct Profile {
+		void add(const Profile& other);
+
+		//  in the order they first show up
+		MapVector<std::string, uint64_t, std::map<std::string, unsigned>> Opcodes;
+		uint64_t Taken = 0;
+		uint64_t Total = 0;
+		//  taken, total
+		MapVector<std::string, std::pair<uint64_t, uint64_t>, std::map<std::string, unsigned>> Sites;
+		MapVector<std::string, uint64_t, std::map<std::string, unsigned>> Blocks;
+		MapVector<std::string, uint64_t, std::map<std::string, unsigned>> Paths;
+		//  calls, inclusive and exclusive cycles
+		MapVector<std::string, std::array<uint64_t, 3>, std::map<std::string, unsigned>> Functions;
+	};
+}
+
+void Profile::add(const Profile& other) {
+	for (auto& opcode : other.Opcodes) {
+		Opcodes[opcode.first] += opcode.second;
+	}
+	Taken += other.Taken;
+	Total += other.Total;
+	for (auto& site : other.Sites) {
+		std::pair<uint64_t, uint64_t>& counts = Sites[site.first];
+		counts.first += site.second.first;
+		counts.second += site.second.second;
+	}
+	for (auto& block : other.Blocks) {
+		Blocks[block.first] += block.second;
+	}
+	for (auto& path : other.Paths) {
+		Paths[path.first] += path.second;
+	}
+	for (auto& function : other.Functions) {
+		std::array<uint64_t, 3>& counts = Functions[function.first];
+		for (unsigned i = 0; i < 3; ++i) {
+			counts[i] += function.second[i];
+		}
+	}
+}
+
+static bool readProfile(const std::string& path, Profile& profile, std::string& error) {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+	if (!buffer) {
+		error = path + ": " + buffer.getError().message();
+		return false;
+	}
+	auto visit = [&profile](const RecordHeader& record, std::vector<std::string>& names, std::vector<uint64_t>& counters) {
+		switch (record.Kind) {
+		case OpcodeRecord:
+			for (uint32_t i = 0; i < record.NumCounters; ++i) {
+				if (counters[i]) {
+					profile.Opcodes[names[i]] += counters[i];
+				}
+			}
+			break;
+		case BranchRecord:
+			profile.Taken += counters[0];
+			profile.Total += counters[1];
+			break;
+		case SiteRecord:
+			for (uint32_t i = 0; i < names.size(); ++i) {
+				std::pair<uint64_t, uint64_t>& counts = profile.Sites[names[i]];
+				counts.first += counters[2 * i];
+				counts.second += counters[2 * i] + counters[2 * i + 1];
+			}
+			break;
+		case BlockRecord:
+			for (uint32_t i = 0; i < names.size(); ++i) {
+				profile.Blocks[names[i]] += counters[i];
+			}
+			break;
+		case PathRecord:
+			for (uint32_t i = 0; i < names.size(); ++i) {
+				profile.Paths[names[i]] += counters[i];
+			}
+			break;
+		case FunctionRecord:
+			for (uint32_t i = 0; i < names.size(); ++i) {
+				//  a function is in every module that defines it, internal ones too
+				std::array<uint64_t, 3>& counts = profile.Functions[names[i]];
+				for (unsigned c = 0; c < 3; ++c) {
+					counts[c] += counters[3 * i + c];
+				}
+			}
+			break;
+		}
+	};
+	StringRef data = (*buffer)->getBuffer();
+	if (!forEachRecord(data.data(), data.size(), visit, error)) {
+		error = path + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+static void writeRecord(raw_ostream& os, RecordKind kind, const std::vector<StringRef>& names, const std::vector<uint64_t>& counters) {
+	RecordHeader record{ kind, (uint32_t)counters.size(), 0 };
+	for (StringRef name : names) {
+		record.NamesSize += name.size() + 1;
+	}
+	os.write(reinterpret_cast<const char*>(&record), sizeof(RecordHeader));
+	for (StringRef name : names) {
+		os << name << '\0';
+	}
+	os.write_zeros(alignRecordSize(record.NamesSize) - record.NamesSize);
+	os.write(reinterpret_cast<const char*>(counters.data()), counters.size() * sizeof(uint64_t));
+}
+
+static void writeProfile(raw_ostream& os, const Profile& profile) {
+	std::vector<StringRef> opcodeNames, siteNames, blockNames, pathNames, functionNames;
+	std::vector<uint64_t> opcodeCounters, branchCounters{ profile.Taken, profile.Total }, siteCounters, blockCounters, pathCounters, functionCounters;
+	for (auto& opcode : profile.Opcodes) {
+		opcodeNames.push_back(opcode.first);
+		opcodeCounters.push_back(opcode.second);
+	}
+	for (auto& site : profile.Sites) {
+		siteNames.push_back(site.first);
+		siteCounters.push_back(site.second.first);
+		siteCounters.push_back(site.second.second - site.second.first);
+	}
+	for (auto& block : profile.Blocks) {
+		blockNames.push_back(block.first);
+		blockCounters.push_back(block.second);
+	}
+	for (auto& path : profile.Paths) {
+		pathNames.push_back(path.first);
+		pathCounters.push_back(path.second);
+	}
+	for (auto& function : profile.Functions) {
+		functionNames.push_back(function.first);
+		functionCounters.insert(functionCounters.end(), function.second.begin(), function.second.end());
+	}
+
+	std::string records;
+	raw_string_ostream recordsStream(records);
+	writeRecord(recordsStream, OpcodeRecord, opcodeNames, opcodeCounters);
+	writeRecord(recordsStream, BranchRecord, std::vector<StringRef>(), branchCounters);
+	writeRecord(recordsStream, SiteRecord, siteNames, siteCounters);
+	writeRecord(recordsStream, BlockRecord, blockNames, blockCounters);
+	writeRecord(recordsStream, PathRecord, pathNames, pathCounters);
+	writeRecord(recordsStream, FunctionRecord, functionNames, functionCounters);
+	recordsStream.flush();
+
+	ProfileHeader header;
+	memcpy(header.Magic, ProfileMagic, sizeof(ProfileMagic));
+	header.Version = ProfileVersion;
+	header.NumRecords = 6;
+	header.Size = sizeof(ProfileHeader) + records.size();
+	os.write(reinterpret_cast<const char*>(&header), sizeof(ProfileHeader));
+	os << records;
+}
+
+static void showProfile(raw_ostream& os, const Profile& profile) {
+	os << "# instructions\n";
+	for (auto& opcode : profile.Opcodes) {
+		os << opcode.first << '\t' << opcode.second << '\n';
+	}
+	os << "# branches\n";
+	os << "taken\t" << profile.Taken << '\n';
+	os << "total\t" << profile.Total << '\n';
+	os << "# sites\n";
+	os << "function\tblock\tlocation\ttaken\ttotal\n";
+	for (auto& site : profile.Sites) {
+		os << site.first << '\t' << site.second.first << '\t' << site.second.second << '\n';
+	}
+	os << "# blocks\n";
+	os << "function\tblock\tcount\n";
+	for (auto& block : profile.Blocks) {
+		os << block.first << '\t' << block.second << '\n';
+	}
+	//  the flat profile, by exclusive cycles
+	std::vector<std::pair<StringRef, std::array<uint64_t, 3>>> functions;
+	uint64_t totalCycles = 0;
+	for (auto& function : profile.Functions) {
+		if (function.second[0]) {
+			functions.push_back(std::make_pair(StringRef(function.first), function.second));
+			totalCycles += function.second[2];
+		}
+	}
+	std::stable_sort(functions.begin(), functions.end(), [](const std::pair<StringRef, std::array<uint64_t, 3>>& a, const std::pair<StringRef, std::array<uint64_t, 3>>& b) {
+		return a.second[2] != b.second[2] ? a.second[2] > b.second[2] : a.second[0] > b.second[0];
+	});
+	os << "# functions\n";
+	os << "function\tcalls\tinclusive\texclusive\texclusive%\n";
+	for (auto& function : functions) {
+		os << function.first << '\t' << function.second[0] << '\t' << function.second[1] << '\t' << function.second[2] << '\t'
+			<< format("%.2f", totalCycles ? 100.0 * function.second[2] / totalCycles : 0.0) << '\n';
+	}
+	os << "# paths\n";
+	os << "function\tpath\tcount\n";
+	for (auto& path : profile.Paths) {
+		os << path.first << '\t' << path.second << '\n';
+	}
+}
+
+//  the sum of all the inputs, read by numThreads threads
+static bool readProfiles(const std::vector<std::string>& files, unsigned numThreads, Profile& profile) {
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, files.size()));
+	std::vector<Profile> partialSums(numThreads);
+	std::vector<std::string> errors(files.size());
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&, t]() {
+			std::size_t begin = files.size() * t / numThreads;
+			std::size_t end = files.size() * (t + 1) / numThreads;
+			for (std::size_t i = begin; i < end; ++i) {
+				Profile input;
+				if (readProfile(files[i], input, errors[i])) {
+					partialSums[t].add(input);
+				}
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	bool ok = true;
+	for (const std::string& error : errors) {
+		if (!error.empty()) {
+			errs() << "cse231-profdata: " << error << '\n';
+			ok = false;
+		}
+	}
+	for (const Profile& partialSum : partialSums) {
+		profile.add(partialSum);
+	}
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+	cl::ParseCommandLineOptions(argc, argv, "CSE 231 profile merger\n");
+
+	if (!MergeCommand && !ShowCommand) {
+		errs() << "cse231-profdata: expected 'merge' or 'show'\n";
+		return 1;
+	}
+
+	std::vector<std::string> files(InputFiles.begin(), InputFiles.end());
+	Profile profile;
+	if (!readProfiles(files, Jobs ? Jobs : hardware_concurrency(), profile)) {
+		return 1;
+	}
+
+	std::error_code ec;
+	ToolOutputFile out(OutputFilename, ec, MergeCommand ? sys::fs::F_None : sys::fs::F_Text);
+	if (ec) {
+		errs() << "cse231-profdata: " << ec.message() << '\n';
+		return 1;
+	}
+	if (MergeCommand) {
+		writeProfile(out.os(), profile);
+	}
+	else {
+		showProfile(out.os(), profile);
+	}
+	out.keep();
+	return 0;
+}
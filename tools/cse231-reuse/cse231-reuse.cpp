@@ -0,0 +1,295 @@
+//===- cse231-reuse.cpp - Reuse distances and strides of CSE 231 traces ---===//
+//
+// Works on the memory access traces written by the cse231_rt runtime for
+// cse231-memtrace (231Trace.h).
+//
+//   cse231-reuse -line-size 64 -strides 4 cse231.*.trace
+//
+// For every load and store site it prints the number of accesses, the
+// histogram of their reuse distances and the most frequent strides. The
+// reuse distance of an access is the number of distinct cache lines the
+// thread touched since it last touched the same line, "cold" for the first
+// touch; an access counts for the line of its first byte. The stride of an
+// access is the distance in bytes from the previous address of the same
+// site on the same thread. Sites are matched by name across traces.
+//
+// Distances are counted with a Fenwick tree over the time of the last
+// access of every line, which is compacted whenever it fills up, so the
+// memory used only grows with the number of distinct lines.
+//
+//===----------------------------------------------------------------------===//
+
+#include "231Trace.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+using namespace cse231;
+
+static cl::list<std::string> InputFiles(
+	cl::Positional,
+	cl::desc("<traces>"),
+	cl::OneOrMore);
+
+static cl::opt<std::string> OutputFilename(
+	"o",
+	cl::desc("Output file"),
+	cl::value_desc("filename"),
+	cl::init("-"));
+
+static cl::opt<unsigned> LineSize(
+	"line-size",
+	cl::desc("Cache line size in bytes, a power of two"),
+	cl::init(64));
+
+static cl::opt<unsigned> NumStrides(
+	"strides",
+	cl::desc("Number of most frequent strides to print for each site"),
+	cl::init(4));
+
+namespace {
+	const uint64_t Cold = UINT64_MAX;
+
+	/*
+	 * The reuse distances of the accesses of one thread. Slot t of the tree
+	 * is 1 if the access at time t is the last access of its line so far.
+	 */
+	class ReuseCounter {
+	public:
+		//  the number of distinct lines touched since the last access to line, or Cold
+		uint64_t access(uint64_t line);
+
+	private:
+		//  the number of set slots in [0, slot)
+		uint64_t prefix(uint64_t slot) const;
+		void add(uint64_t slot, int32_t delta);
+		//  renumbers the live slots 0, 1, ... in order
+		void compact();
+
+		std::unordered_map<uint64_t, uint64_t> LastSlot;
+		//  1-based Fenwick tree
+		std::vector<int32_t> Tree;
+		uint64_t Now = 0;
+	};
+
+	struct SiteStats {
+		std::string Name;
+		uint64_t Accesses = 0;
+		uint64_t Bytes = 0;
+		//  cold, 0, 1, 2-3, 4-7, ...
+		std::vector<uint64_t> Reuse;
+		std::map<int64_t, uint64_t> Strides;
+	};
+}
+
+uint64_t ReuseCounter::prefix(uint64_t slot) const {
+	uint64_t sum = 0;
+	for (uint64_t i = slot; i > 0; i -= i & (~i + 1)) {
+		sum += Tree[i];
+	}
+	return sum;
+}
+
+void ReuseCounter::add(uint64_t slot, int32_t delta) {
+	for (uint64_t i = slot + 1; i < Tree.size(); i += i & (~i + 1)) {
+		Tree[i] += delta;
+	}
+}
+
+void ReuseCounter::compact() {
+	std::vector<std::pair<uint64_t, uint64_t>> live;
+	for (auto& last : LastSlot) {
+		live.push_back(std::make_pair(last.second, last.first));
+	}
+	std::sort(live.begin(), live.end());
+	Tree.assign(std::max<uint64_t>(2 * live.size(), 1 << 16) + 1, 0);
+	for (uint64_t slot = 0; slot < live.size(); ++slot) {
+		LastSlot[live[slot].second] = slot;
+		add(slot, 1);
+	}
+	Now = live.size();
+}
+
+uint64_t ReuseCounter::access(uint64_t line) {
+	if (Now + 1 >= Tree.size()) {
+		compact();
+	}
+	uint64_t distance = Cold;
+	auto inserted = LastSlot.insert(std::make_pair(line, Now));
+	if (!inserted.second) {
+		uint64_t last = inserted.first->second;
+		distance = prefix(Now) - prefix(last + 1);
+		add(last, -1);
+		inserted.first->second = Now;
+	}
+	add(Now, 1);
+	++Now;
+	return distance;
+}
+
+static unsigned getReuseBucket(uint64_t distance) {
+	if (distance == Cold) {
+		return 0;
+	}
+	return distance == 0 ? 1 : 2 + Log2_64(distance);
+}
+
+static std::string getReuseBucketName(unsigned bucket) {
+	if (bucket == 0) {
+		return "cold";
+	}
+	if (bucket == 1) {
+		return "0";
+	}
+	uint64_t low = uint64_t(1) << (bucket - 2);
+	uint64_t high = 2 * low - 1;
+	return low == high ? std::to_string(low) : std::to_string(low) + "-" + std::to_string(high);
+}
+
+namespace {
+	//  the state of one trace while it is read
+	struct TraceReader {
+		//  trace site id -> index into Sites
+		std::vector<unsigned> SiteIndex;
+		std::map<uint32_t, ReuseCounter> Threads;
+		//  thread -> trace site id -> last address
+		std::map<uint32_t, std::unordered_map<uint32_t, uint64_t>> LastAddress;
+	};
+}
+
+static bool readTrace(const std::string& path, std::vector<SiteStats>& sites, std::map<std::string, unsigned>& siteIndex) {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+	if (!buffer) {
+		errs() << "cse231-reuse: " << path << ": " << buffer.getError().message() << '\n';
+		return false;
+	}
+
+	TraceReader reader;
+	unsigned lineShift = Log2_32(LineSize);
+	auto visitSites = [&](uint32_t firstSite, std::vector<std::string>& names) {
+		if (reader.SiteIndex.size() < firstSite + names.size()) {
+			reader.SiteIndex.resize(firstSite + names.size(), UINT32_MAX);
+		}
+		for (unsigned i = 0; i < names.size(); ++i) {
+			auto inserted = siteIndex.insert(std::make_pair(names[i], sites.size()));
+			if (inserted.second) {
+				sites.emplace_back();
+				sites.back().Name = names[i];
+			}
+			reader.SiteIndex[firstSite + i] = inserted.first->second;
+		}
+	};
+	auto visitAccesses = [&](uint32_t thread, const TraceAccess* accesses, uint64_t num) {
+		ReuseCounter& reuse = reader.Threads[thread];
+		std::unordered_map<uint32_t, uint64_t>& lastAddress = reader.LastAddress[thread];
+		for (uint64_t i = 0; i < num; ++i) {
+			const TraceAccess& access = accesses[i];
+			if (access.Site >= reader.SiteIndex.size() || reader.SiteIndex[access.Site] == UINT32_MAX) {
+				continue;
+			}
+			SiteStats& site = sites[reader.SiteIndex[access.Site]];
+			++site.Accesses;
+			site.Bytes += access.Size;
+			unsigned bucket = getReuseBucket(reuse.access(access.Address >> lineShift));
+			if (site.Reuse.size() <= bucket) {
+				site.Reuse.resize(bucket + 1);
+			}
+			++site.Reuse[bucket];
+			auto inserted = lastAddress.insert(std::make_pair(access.Site, access.Address));
+			if (!inserted.second) {
+				++site.Strides[int64_t(access.Address - inserted.first->second)];
+				inserted.first->second = access.Address;
+			}
+		}
+	};
+
+	std::string error;
+	StringRef data = (*buffer)->getBuffer();
+	if (!forEachTraceBlock(data.data(), data.size(), visitSites, visitAccesses, error)) {
+		errs() << "cse231-reuse: " << path << ": " << error << '\n';
+		return false;
+	}
+	if (!error.empty()) {
+		errs() << "cse231-reuse: " << path << ": " << error << ", ignoring the rest\n";
+	}
+	return true;
+}
+
+static void showStats(raw_ostream& os, const std::vector<SiteStats>& sites) {
+	os << "# accesses\n";
+	os << "function\tblock\tlocation\taccess\tcount\tbytes\n";
+	for (const SiteStats& site : sites) {
+		if (site.Accesses) {
+			os << site.Name << '\t' << site.Accesses << '\t' << site.Bytes << '\n';
+		}
+	}
+	os << "# reuse\n";
+	os << "function\tblock\tlocation\taccess\tdistance\tcount\n";
+	for (const SiteStats& site : sites) {
+		for (unsigned bucket = 0; bucket < site.Reuse.size(); ++bucket) {
+			if (site.Reuse[bucket]) {
+				os << site.Name << '\t' << getReuseBucketName(bucket) << '\t' << site.Reuse[bucket] << '\n';
+			}
+		}
+	}
+	os << "# strides\n";
+	os << "function\tblock\tlocation\taccess\tstride\tcount\n";
+	for (const SiteStats& site : sites) {
+		std::vector<std::pair<int64_t, uint64_t>> strides(site.Strides.begin(), site.Strides.end());
+		std::stable_sort(strides.begin(), strides.end(), [](const std::pair<int64_t, uint64_t>& a, const std::pair<int64_t, uint64_t>& b) {
+			return a.second > b.second;
+		});
+		uint64_t other = 0;
+		for (unsigned i = 0; i < strides.size(); ++i) {
+			if (i < NumStrides) {
+				os << site.Name << '\t' << strides[i].first << '\t' << strides[i].second << '\n';
+			}
+			else {
+				other += strides[i].second;
+			}
+		}
+		if (other) {
+			os << site.Name << "\tother\t" << other << '\n';
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+	cl::ParseCommandLineOptions(argc, argv, "CSE 231 reuse distance and stride analysis\n");
+
+	if (!isPowerOf2_32(LineSize)) {
+		errs() << "cse231-reuse: -line-size must be a power of two\n";
+		return 1;
+	}
+
+	std::vector<SiteStats> sites;
+	std::map<std::string, unsigned> siteIndex;
+	bool ok = true;
+	for (const std::string& path : InputFiles) {
+		ok &= readTrace(path, sites, siteIndex);
+	}
+	if (!ok) {
+		return 1;
+	}
+
+	std::error_code ec;
+	ToolOutputFile out(OutputFilename, ec, sys::fs::F_Text);
+	if (ec) {
+		errs() << "cse231-reuse: " << ec.message() << '\n';
+		return 1;
+	}
+	showStats(out.os(), sites);
+	out.keep();
+	return 0;
+}